@@ -0,0 +1,180 @@
+#include <delameta/http/http.h>
+#include <fmt/format.h>
+#include <catch2/catch_test_macros.hpp>
+#include <zlib.h>
+
+using namespace Project;
+namespace http = delameta::http;
+
+enum class Encoding { gzip, deflate };
+
+static size_t compress_min_size = 1024;
+static int compress_level = Z_DEFAULT_COMPRESSION;
+static std::unordered_map<std::string, int> compress_route_levels;
+
+// Route levels are given as `{"<METHOD> <path>": "<level>"}` like rate limits and deadlines, `*` applies to every other route
+[[export]]
+void compress_setup(int min_size, int level, const std::unordered_map<std::string, std::string>& route_levels) {
+    compress_min_size = min_size < 0 ? SIZE_MAX : min_size;
+    compress_level = level;
+    for (const auto& [route, route_level] : route_levels) {
+        compress_route_levels[route] = std::stoi(route_level);
+    }
+}
+
+// Deflate `in` in fixed size slices into the result. The whole body and its compressed copy are held at once,
+// responses streamed through `body_stream` are sent uncompressed.
+static auto compress(std::string_view in, Encoding encoding, int level) -> std::optional<std::string> {
+    z_stream zs = {};
+    int window_bits = encoding == Encoding::gzip ? 15 + 16 : 15;
+    if (deflateInit2(&zs, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return std::nullopt;
+    }
+
+    std::string out;
+    out.reserve(deflateBound(&zs, in.size()));
+
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs.avail_in = in.size();
+
+    char buf[16 * 1024];
+    int res;
+    do {
+        zs.next_out = reinterpret_cast<Bytef*>(buf);
+        zs.avail_out = sizeof(buf);
+        res = deflate(&zs, Z_FINISH);
+        out.append(buf, sizeof(buf) - zs.avail_out);
+    } while (res == Z_OK);
+
+    deflateEnd(&zs);
+    if (res != Z_STREAM_END) {
+        return std::nullopt;
+    }
+    return out;
+}
+
+static auto trim(std::string_view sv) -> std::string_view {
+    while (not sv.empty() and sv.front() == ' ') sv.remove_prefix(1);
+    while (not sv.empty() and sv.back() == ' ') sv.remove_suffix(1);
+    return sv;
+}
+
+// q-value of `coding` in an `Accept-Encoding` header, 0 when it is not acceptable
+static auto encoding_quality(std::string_view accept, std::string_view coding) -> double {
+    double wildcard = 0;
+    while (not accept.empty()) {
+        auto comma = accept.find(',');
+        auto item = accept.substr(0, comma);
+        accept = comma == std::string_view::npos ? std::string_view() : accept.substr(comma + 1);
+
+        auto semicolon = item.find(';');
+        auto name = trim(item.substr(0, semicolon));
+        double q = 1;
+        if (semicolon != std::string_view::npos) {
+            auto param = trim(item.substr(semicolon + 1));
+            if (param.starts_with("q=")) q = std::strtod(std::string(param.substr(2)).c_str(), nullptr);
+        }
+
+        if (name.size() == coding.size() and std::equal(name.begin(), name.end(), coding.begin(), [](char a, char b) {
+            return std::tolower(a) == std::tolower(b);
+        })) {
+            return q;
+        }
+        if (name == "*") wildcard = q;
+    }
+    return wildcard;
+}
+
+static auto accepted_encoding(const http::RequestReader& req) -> std::optional<Encoding> {
+    auto it = req.headers.find("Accept-Encoding");
+    if (it == req.headers.end()) {
+        it = req.headers.find("accept-encoding");
+    }
+    if (it == req.headers.end()) {
+        return std::nullopt;
+    }
+
+    std::string_view accept = it->second;
+    auto gzip = encoding_quality(accept, "gzip");
+    auto deflate = encoding_quality(accept, "deflate");
+    if (gzip > 0 and gzip >= deflate) return Encoding::gzip;
+    if (deflate > 0) return Encoding::deflate;
+    return std::nullopt;
+}
+
+// Compress dynamic JSON bodies for clients that accept it
+[[export]]
+void compress_response(const http::RequestReader& req, http::ResponseWriter& res) {
+    if (res.body.size() < compress_min_size) return;
+    if (res.headers.find("Content-Encoding") != res.headers.end()) return;
+
+    auto content_type = res.headers.find("Content-Type");
+    if (content_type == res.headers.end() or not std::string_view(content_type->second).starts_with("application/json")) return;
+
+    auto encoding = accepted_encoding(req);
+    if (not encoding) return;
+
+    auto level = compress_level;
+    auto it = compress_route_levels.find(fmt::format("{} {}", req.method, req.url.path));
+    if (it == compress_route_levels.end()) it = compress_route_levels.find("*");
+    if (it != compress_route_levels.end()) level = it->second;
+    if (level == 0) return;
+
+    auto body = compress(res.body, *encoding, level);
+    if (not body) return;
+
+    res.body = std::move(*body);
+    res.headers["Content-Encoding"] = *encoding == Encoding::gzip ? "gzip" : "deflate";
+    res.headers["Content-Length"] = std::to_string(res.body.size());
+    res.headers["Vary"] = "Accept-Encoding";
+}
+
+TEST_CASE("4. compress", "[compress]") {
+    const std::string json = "[" + std::string(4096, ' ') + "]";
+
+    http::RequestReader req;
+    http::ResponseWriter res;
+    req.headers["Accept-Encoding"] = "gzip, deflate";
+    res.headers["Content-Type"] = "application/json";
+    res.body = json;
+
+    compress_response(req, res);
+    REQUIRE(res.headers["Content-Encoding"] == "gzip");
+    REQUIRE(res.body.size() < json.size());
+
+    z_stream zs = {};
+    REQUIRE(inflateInit2(&zs, 15 + 16) == Z_OK);
+
+    std::string decompressed(json.size(), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(res.body.data());
+    zs.avail_in = res.body.size();
+    zs.next_out = reinterpret_cast<Bytef*>(decompressed.data());
+    zs.avail_out = decompressed.size();
+    REQUIRE(inflate(&zs, Z_FINISH) == Z_STREAM_END);
+    inflateEnd(&zs);
+
+    REQUIRE(decompressed == json);
+
+    // refused encodings are not used
+    req.headers["Accept-Encoding"] = "gzip;q=0, deflate;q=0.5";
+    REQUIRE(accepted_encoding(req) == Encoding::deflate);
+    req.headers["Accept-Encoding"] = "gzip; q=0, *;q=0";
+    REQUIRE(not accepted_encoding(req));
+    req.headers["Accept-Encoding"] = "br, *";
+    REQUIRE(accepted_encoding(req) == Encoding::gzip);
+
+    // levels are per method and path
+    compress_setup(1024, Z_DEFAULT_COMPRESSION, {{"GET /plain", "0"}});
+    req.method = "GET";
+    req.url.path = "/plain";
+    res.headers.erase("Content-Encoding");
+    res.body = json;
+    compress_response(req, res);
+    REQUIRE(res.body == json);
+
+    req.method = "POST";
+    compress_response(req, res);
+    REQUIRE(res.body != json);
+
+    compress_route_levels.clear();
+}
@@ -1,8 +1,15 @@
 #include <sqlpp11/sqlpp11.h>
 #include <sqlpp11/sqlite3/connection.h>
+#include <fmt/format.h>
 #include <delameta/http/http.h>
 #include <delameta/opts.h>
+#include <delameta/debug.h>
 #include <catch2/catch_test_macros.hpp>
+#include <thread>
+#include <mutex>
+#include <unordered_set>
+#include <csignal>
+#include <unistd.h>
 
 using namespace Project;
 using etl::Ok;
@@ -13,21 +20,277 @@ using delameta::Error;
 using sql_db = sqlpp::sqlite3::connection;
 namespace http = delameta::http;
 
+extern auto db_query_int(sql_db& db, const char* query) -> int64_t;
+extern auto deadline_check() -> std::optional<http::Error>;
+extern auto user_verify(const http::RequestReader& req, http::ResponseWriter& res) -> http::Result<std::string>;
+
 const auto DB_PATH = "assets/database.db";
 
+static int db_shards = 1;
+
 [[export]]
-auto db_open(const char* path) -> sql_db {
+void db_set_shards(int shards) {
+    db_shards = std::max(shards, 1);
+}
+
+[[export]]
+auto db_get_shards() -> int {
+    return db_shards;
+}
+
+[[export]]
+auto db_shard_path(int shard, int shards) -> std::string {
+    if (shards <= 1) return DB_PATH;
+    return fmt::format("assets/database.{}.db", shard);
+}
+
+[[export]]
+auto db_shard_of(std::string_view username, int shards) -> int {
+    // FNV-1a, so the mapping is stable across builds and platforms
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : username) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ull;
+    }
+    return static_cast<int>(hash % std::max(shards, 1));
+}
+
+// Quotes a value as an SQL string literal
+[[export]]
+auto db_quote(const std::string& value) -> std::string {
+    char* quoted = sqlite3_mprintf("%Q", value.c_str());
+    std::string res = quoted;
+    sqlite3_free(quoted);
+    return res;
+}
+
+// In-memory engine: every shard file is mirrored by a shared `memdb` database that lives
+// as long as its keeper connection, and is periodically snapshotted back to the file.
+// Other paths, e.g. from the `db-path` query, are opened on disk.
+static std::unordered_set<std::string> db_memory_paths;
+static std::mutex db_memory_mutex;
+static std::unordered_map<std::string, sql_db> db_memory_keepers;
+
+static auto db_memory_config(const std::string& path) -> sqlpp::sqlite3::connection_config {
     sqlpp::sqlite3::connection_config config;
-    config.path_to_database = path ? path : DB_PATH;
-    config.flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    config.path_to_database = "file:/" + path + "?vfs=memdb";
+    config.flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI;
     config.debug = delameta::Opts::verbose;
-    return sql_db(config);
+    return config;
+}
+
+// Restores the last snapshot of `path`, if any. A failed restore must not leave an empty database
+// behind, its next snapshot would replace the file.
+static auto db_memory_load(const std::string& path) -> Result<void> {
+    std::lock_guard<std::mutex> lock(db_memory_mutex);
+    if (db_memory_keepers.contains(path)) return Ok();
+
+    auto keeper = sql_db(db_memory_config(path));
+
+    if (::access(path.c_str(), F_OK) == 0) {
+        sqlite3* disk = nullptr;
+        int rc = sqlite3_open_v2(path.c_str(), &disk, SQLITE_OPEN_READONLY, nullptr);
+        if (rc == SQLITE_OK) {
+            auto backup = sqlite3_backup_init(keeper.native_handle(), "main", disk, "main");
+            if (backup == nullptr) {
+                rc = sqlite3_errcode(keeper.native_handle());
+            } else {
+                rc = sqlite3_backup_step(backup, -1);
+                int finish = sqlite3_backup_finish(backup);
+                if (rc == SQLITE_DONE) rc = finish;
+            }
+        }
+        sqlite3_close(disk);
+
+        if (rc != SQLITE_OK) {
+            return Err(Error{rc, fmt::format("Failed to restore {}: {}", path, sqlite3_errstr(rc))});
+        }
+    }
+
+    db_memory_keepers.emplace(path, std::move(keeper));
+    return Ok();
+}
+
+[[export]]
+void db_memory_snapshot() {
+    // the periodic and the shutdown snapshots share the temporary files
+    static std::mutex snapshot_mutex;
+    std::lock_guard<std::mutex> snapshot_lock(snapshot_mutex);
+
+    std::vector<std::pair<std::string, sql_db*>> keepers;
+    {
+        std::lock_guard<std::mutex> lock(db_memory_mutex);
+        for (auto& [path, keeper] : db_memory_keepers) {
+            keepers.emplace_back(path, &keeper);
+        }
+    }
+
+    for (auto& [path, keeper] : keepers) {
+        auto tmp = path + ".snapshot";
+        ::remove(tmp.c_str());
+        try {
+            keeper->execute(fmt::format("VACUUM INTO {}", db_quote(tmp)));
+            std::rename(tmp.c_str(), path.c_str());
+        } catch (const std::exception& e) {
+            delameta::warning(FL, fmt::format("Failed to snapshot {}: {}", path, e.what()));
+        }
+    }
+}
+
+[[export]]
+auto db_set_memory(int snapshot_interval) -> Result<void> {
+    db_memory_paths.insert(db_shard_path(0, 1));
+    for (int shard = 0; shard < db_shards; ++shard) {
+        db_memory_paths.insert(db_shard_path(shard, db_shards));
+    }
+
+    // every file is restored up front, so startup fails instead of serving an empty database
+    for (const auto& path : db_memory_paths) {
+        TRY(db_memory_load(path));
+    }
+
+    // take a last snapshot on SIGINT and SIGTERM, threads started from here on inherit the blocked signals
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    std::thread([signals]() {
+        int sig;
+        sigwait(&signals, &sig);
+        db_memory_snapshot();
+        std::_Exit(0);
+    }).detach();
+
+    if (snapshot_interval <= 0) return Ok();
+
+    std::thread([snapshot_interval]() {
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::seconds(snapshot_interval));
+            db_memory_snapshot();
+        }
+    }).detach();
+    return Ok();
 }
 
 [[export]]
-auto db_dependency(const http::RequestReader& req, http::ResponseWriter&) -> sql_db {
+auto db_open(const char* path) -> sql_db {
+    std::string db_path = path ? path : DB_PATH;
+    const bool in_memory = db_memory_paths.contains(db_path);
+    if (in_memory) {
+        if (auto res = db_memory_load(db_path); res.is_err()) {
+            throw std::runtime_error(res.unwrap_err().what);
+        }
+    }
+
+    sqlpp::sqlite3::connection_config config;
+    if (in_memory) {
+        config = db_memory_config(db_path);
+    } else {
+        config.path_to_database = db_path;
+        config.flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+        config.debug = delameta::Opts::verbose;
+    }
+
+    // wait for concurrent writers, e.g. online migrations, instead of failing right away
+    auto db = sql_db(config);
+    db.execute("PRAGMA busy_timeout = 1000");
+    return db;
+}
+
+// Users live in the primary database. Like `db_dependency`, requests past their deadline are rejected
+// before they touch the database.
+[[export]]
+auto db_users_dependency(const http::RequestReader& req, http::ResponseWriter&) -> http::Result<sql_db> {
+    if (auto err = deadline_check()) {
+        return Err(std::move(*err));
+    }
+
+    auto it = req.url.queries.find("db-path");
+    return Ok(db_open(it == req.url.queries.end() ? nullptr : it->second.c_str()));
+}
+
+// Todos live in the shard of the authenticated user
+[[export]]
+auto db_dependency(const http::RequestReader& req, http::ResponseWriter& res) -> http::Result<sql_db> {
+    if (auto err = deadline_check()) {
+        return Err(std::move(*err));
+    }
+
     auto it = req.url.queries.find("db-path");
-    return db_open(it == req.url.queries.end() ? nullptr : it->second.c_str());
+    if (it != req.url.queries.end()) {
+        return Ok(db_open(it->second.c_str()));
+    }
+
+    if (db_shards == 1) {
+        return Ok(db_open(nullptr));
+    }
+
+    // unauthenticated requests are rejected by `user_get_id` anyway
+    auto username = user_verify(req, res);
+    if (username.is_err()) {
+        return Ok(db_open(nullptr));
+    }
+
+    auto path = db_shard_path(db_shard_of(username.unwrap(), db_shards), db_shards);
+    return Ok(db_open(path.c_str()));
+}
+
+TEST_CASE("3. shard", "[shard]") {
+    REQUIRE(db_shard_path(0, 1) == DB_PATH);
+    REQUIRE(db_shard_path(3, 4) == "assets/database.3.db");
+    REQUIRE(db_shard_of("Prapto", 1) == 0);
+
+    for (int shards = 1; shards <= 16; ++shards) {
+        auto shard = db_shard_of("Prapto", shards);
+        REQUIRE(shard >= 0);
+        REQUIRE(shard < shards);
+        REQUIRE(shard == db_shard_of("Prapto", shards));
+    }
+}
+
+TEST_CASE("8. memory", "[memory]") {
+    auto count = [](const char* path) {
+        auto db = db_open(path);
+        return db_query_int(db, "SELECT COUNT(*) FROM MemoryTest");
+    };
+
+    {
+        auto db = db_open("memory.db");
+        db.execute("CREATE TABLE MemoryTest (value INTEGER)");
+        db.execute("INSERT INTO MemoryTest VALUES (1)");
+    }
+
+    // restored from the file
+    db_memory_paths.insert("memory.db");
+    REQUIRE(count("memory.db") == 1);
+
+    db_open("memory.db").execute("INSERT INTO MemoryTest VALUES (2)");
+    REQUIRE(count("memory.db") == 2);
+
+    // only a snapshot writes to the file
+    db_memory_paths.clear();
+    REQUIRE(count("memory.db") == 1);
+    db_memory_paths.insert("memory.db");
+
+    db_memory_snapshot();
+    db_memory_keepers.clear();
+    REQUIRE(count("memory.db") == 2);
+
+    db_memory_keepers.clear();
+
+    // a file that cannot be restored is not replaced by an empty database
+    {
+        std::FILE* file = std::fopen("memory.db", "w");
+        std::fputs("not a database", file);
+        std::fclose(file);
+    }
+    REQUIRE_THROWS(db_open("memory.db"));
+    REQUIRE(not db_memory_keepers.contains("memory.db"));
+
+    db_memory_paths.clear();
+    ::remove("memory.db");
 }
 
 TEST_CASE("9. cleanup db", "[cleanup]") {
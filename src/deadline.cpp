@@ -0,0 +1,148 @@
+#include <delameta/http/http.h>
+#include <catch2/catch_test_macros.hpp>
+#include <atomic>
+#include <charconv>
+
+using namespace Project;
+namespace http = delameta::http;
+using steady_clock = std::chrono::steady_clock;
+
+// Request deadlines, given per request by the `X-Request-Timeout` header (ms) or per route at startup.
+// The deadline of the request being executed on this thread is checked before expensive steps.
+static std::unordered_map<std::string, std::chrono::milliseconds> deadline_routes;
+static thread_local std::optional<steady_clock::time_point> deadline;
+
+// Longest deadline a client can ask for, so a header cannot overflow the deadline or hold a worker forever
+const auto DEADLINE_MAX = std::chrono::milliseconds(60'000);
+
+[[export]]
+void deadline_setup(const std::unordered_map<std::string, std::string>& routes) {
+    for (const auto& [route, ms] : routes) {
+        deadline_routes[route] = std::chrono::milliseconds(std::stoul(ms));
+    }
+}
+
+[[export]]
+void deadline_begin(const std::string& route, std::optional<std::string_view> timeout, steady_clock::time_point start) {
+    deadline.reset();
+
+    // a header that is not a number of ms is ignored
+    uint64_t ms = 0;
+    if (timeout) {
+        auto [end, ec] = std::from_chars(timeout->data(), timeout->data() + timeout->size(), ms);
+        if (ec == std::errc() and end == timeout->data() + timeout->size()) {
+            deadline = start + std::chrono::milliseconds(std::min<uint64_t>(ms, DEADLINE_MAX.count()));
+            return;
+        }
+    }
+
+    if (deadline_routes.empty()) return;
+
+    auto it = deadline_routes.find(route);
+    if (it == deadline_routes.end()) it = deadline_routes.find("*");
+    if (it != deadline_routes.end()) deadline = start + it->second;
+}
+
+[[export]]
+void deadline_end() {
+    deadline.reset();
+}
+
+[[export]]
+auto deadline_check() -> std::optional<http::Error> {
+    if (deadline and steady_clock::now() > *deadline) {
+        return http::Error{http::StatusServiceUnavailable, "Deadline exceeded"};
+    }
+    return std::nullopt;
+}
+
+// Adaptive load shedder: the number of requests in flight, queued or running, is capped by a limit that grows by one
+// after a full window of fast requests and is cut by a quarter when a request exceeds the target latency.
+const int SHED_MIN_LIMIT = 1;
+const int SHED_MAX_LIMIT = 4096;
+
+static std::chrono::milliseconds shed_target{0};
+static std::atomic<int> shed_in_flight = 0;
+static std::atomic<int> shed_limit = SHED_MAX_LIMIT / 16;
+static std::atomic<int> shed_fast = 0;
+static std::atomic<int64_t> shed_last_decrease = 0;
+
+[[export]]
+void shed_setup(int target_latency_ms) {
+    shed_target = std::chrono::milliseconds(target_latency_ms);
+}
+
+[[export]]
+auto shed_admit() -> bool {
+    if (shed_target.count() == 0) return true;
+
+    if (++shed_in_flight > shed_limit.load(std::memory_order_relaxed)) {
+        --shed_in_flight;
+        return false;
+    }
+    return true;
+}
+
+[[export]]
+void shed_finish(steady_clock::time_point start) {
+    if (shed_target.count() == 0) return;
+
+    --shed_in_flight;
+    auto now = steady_clock::now();
+    auto limit = shed_limit.load(std::memory_order_relaxed);
+
+    if (now - start > shed_target) {
+        // decrease at most once per target latency, requests in flight at that time all report slow
+        auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+        auto last = shed_last_decrease.load(std::memory_order_relaxed);
+        if (now_ms - last >= shed_target.count() and shed_last_decrease.compare_exchange_strong(last, now_ms)) {
+            shed_limit = std::max(SHED_MIN_LIMIT, limit - std::max(1, limit / 4));
+            shed_fast = 0;
+        }
+    } else if (++shed_fast >= limit) {
+        shed_fast = 0;
+        shed_limit = std::min(SHED_MAX_LIMIT, limit + 1);
+    }
+}
+
+TEST_CASE("6. deadline", "[deadline]") {
+    auto start = steady_clock::now();
+
+    SECTION("no deadline") {
+        deadline_begin("GET /todos", std::nullopt, start - std::chrono::hours(1));
+        REQUIRE(not deadline_check());
+        deadline_end();
+    }
+
+    SECTION("header") {
+        deadline_begin("GET /todos", "1000", start);
+        REQUIRE(not deadline_check());
+
+        deadline_begin("GET /todos", "10", start - std::chrono::milliseconds(20));
+        REQUIRE(deadline_check()->what == "Deadline exceeded");
+        deadline_end();
+        REQUIRE(not deadline_check());
+
+        // invalid values are ignored, huge ones are clamped
+        deadline_begin("GET /todos", "-1", start - std::chrono::hours(1));
+        REQUIRE(not deadline_check());
+        deadline_begin("GET /todos", "10ms", start - std::chrono::hours(1));
+        REQUIRE(not deadline_check());
+        deadline_begin("GET /todos", "99999999999999999999999", start - std::chrono::hours(1));
+        REQUIRE(not deadline_check());
+        deadline_begin("GET /todos", "18446744073709551615", start - std::chrono::hours(1));
+        REQUIRE(deadline_check()->what == "Deadline exceeded");
+        deadline_end();
+    }
+
+    SECTION("route") {
+        deadline_setup({{"GET /todos", "10"}});
+        deadline_begin("GET /todos", std::nullopt, start - std::chrono::milliseconds(20));
+        REQUIRE(deadline_check());
+
+        deadline_begin("GET /users", std::nullopt, start - std::chrono::milliseconds(20));
+        REQUIRE(not deadline_check());
+        deadline_end();
+        deadline_routes.clear();
+    }
+}
@@ -16,8 +16,16 @@ using etl::Ok;
 using etl::Err;
 namespace http = delameta::http;
 
-extern void users_create_table(const char* path = nullptr);
-extern void todos_create_table(const char* path = nullptr);
+extern void db_migrate(bool background);
+extern void todos_archive_start(std::chrono::hours age, std::chrono::seconds interval);
+extern void todos_rebalance(int from, int to);
+extern void db_set_shards(int shards);
+extern auto db_set_memory(int snapshot_interval) -> Result<void>;
+extern void compress_setup(int min_size, int level, const std::unordered_map<std::string, std::string>& route_levels);
+extern void rate_limit_setup(const std::unordered_map<std::string, std::string>& limits);
+extern void deadline_setup(const std::unordered_map<std::string, std::string>& routes);
+extern void shed_setup(int target_latency_ms);
+extern auto server_listen(http::Http& http, const std::string& host, int workers, int max_connections) -> Result<void>;
 
 using Args = std::unordered_map<std::string, std::string>;
 
@@ -27,6 +35,10 @@ auto Opts::convert_string_into(const std::string& str) -> Result<Args> {
     return json::deserialize<Args>(str).except([](const char* err) { return Error{-1, err}; });
 }
 
+// Initialized before the default priority static initializers, so that `--startup-profile`
+// also covers static route registration
+static const std::chrono::steady_clock::time_point process_start __attribute__((init_priority(101))) = std::chrono::steady_clock::now();
+
 static auto now() {
     return std::chrono::time_point_cast<std::chrono::seconds>(std::chrono::system_clock::now());
 }
@@ -34,21 +46,39 @@ static auto now() {
 OPTS_MAIN(
     (TODO, "Simple todo list")
     ,
-    //  |    Type   |   Name  | Short |    Long   |              Help               |     Default     |
-        (URL        , uri     ,  'H'  , "host"    , "Specify host to serve HTTP"    , "localhost:5000")
-        (int        , max_sock,  'n'  , "max-sock", "Set number of server socket"   , "4"             )
-        (bool       , verbose ,  'v'  , "verbose" , "Set verbosity"                                   )
-        (bool       , version ,  'V'  , "version" , "Print version"                                   )
-        (bool       , test    ,  't'  , "test"    , "Enable testing"                                  )
-        (std::string, route   ,  'r'  , "route"   , "Execute HTTP route"            , ""              )
-        (std::string, method  ,  'm'  , "method"  , "Specify HTTP method"           , ""              )
-        (Args       , headers ,  'a'  , "headers" , "Specify HTTP headers"          , ""              )
-        (Args       , queries ,  'q'  , "queries" , "Specify HTTP URL queries"      , ""              )
-        (std::string, body    ,  'd'  , "body"    , "Specify HTTP body"             , ""              )
-        (std::string, token   ,  'T'  , "token"   , "Specify access token"          , ""              )
-        (bool       , is_json ,  'j'  , "is-json" , "Set data type to be json"                        )
-        (bool       , is_text ,  'x'  , "is-text" , "Set data type to be plain text"                  )
-        (bool       , is_form ,  'f'  , "is-form" , "Set data type to be form-urlencoded"             )
+    //  |     Type    |       Name       | Short |        Long        |                                Help                               |     Default      |
+        (URL         , uri              ,  'H'  , "host"             , "Specify host to serve HTTP"                                      , "localhost:5000")
+        (int         , max_sock         ,  'n'  , "max-sock"         , "Set number of server socket"                                     , "4"             )
+        (bool        , epoll            ,  'E'  , "epoll"            , "Serve with the epoll event loop"                                                   )
+        (int         , workers          ,  'w'  , "workers"          , "Set number of worker threads, 0 for one per core"                , "0"             )
+        (int         , max_conn         ,  'c'  , "max-conn"         , "Set maximum number of connections for --epoll"                   , "10000"         )
+        (int         , compress_min     ,  'z'  , "compress-min"     , "Compress JSON responses from this size, -1 to disable"           , "1024"          )
+        (int         , compress_level   ,  'Z'  , "compress-level"   , "Set compression level"                                           , "6"             )
+        (Args        , compress_routes  ,  'L'  , "compress-routes"  , "Set compression level per route"                                 , ""              )
+        (Args        , rate_limits      ,  'l'  , "rate-limits"      , "Set rate limits per route as count[/unit][/burst]"               , ""              )
+        (Args        , deadlines        ,  'D'  , "deadlines"        , "Set default request deadline per route in ms"                    , ""              )
+        (int         , shed_latency     ,  'S'  , "shed-latency"     , "Shed load when latency exceeds this many ms, 0 to disable"       , "0"             )
+        (int         , shards           ,  's'  , "db-shards"        , "Set number of database shards"                                   , "1"             )
+        (bool        , migrate          ,  'u'  , "migrate"          , "Apply every pending database migration and exit"                                   )
+        (int         , rebalance        ,  'R'  , "db-rebalance"     , "Move todos from this many shards into --db-shards and exit"      , "0"             )
+        (bool        , memory           ,  'M'  , "db-memory"        , "Keep the database in memory, snapshotted to disk"                                  )
+        (int         , snapshot         ,  'i'  , "db-snapshot"      , "Seconds between in-memory database snapshots"                    , "60"            )
+        (int         , archive_age      ,  'A'  , "archive-age"      , "Archive completed todos older than this many days, 0 to disable" , "0"             )
+        (int         , archive_interval ,  'I'  , "archive-interval" , "Seconds between two archive runs"                                , "3600"          )
+        (bool        , startup_profile  ,  'P'  , "startup-profile"  , "Print time spent in each startup phase"                                            )
+        (bool        , verbose          ,  'v'  , "verbose"          , "Set verbosity"                                                                     )
+        (bool        , version          ,  'V'  , "version"          , "Print version"                                                                     )
+        (bool        , test             ,  't'  , "test"             , "Enable testing"                                                                    )
+        (bool        , bench            ,  'B'  , "bench"            , "Run benchmarks"                                                                    )
+        (std::string , route            ,  'r'  , "route"            , "Execute HTTP route"                                              , ""              )
+        (std::string , method           ,  'm'  , "method"           , "Specify HTTP method"                                             , ""              )
+        (Args        , headers          ,  'a'  , "headers"          , "Specify HTTP headers"                                            , ""              )
+        (Args        , queries          ,  'q'  , "queries"          , "Specify HTTP URL queries"                                        , ""              )
+        (std::string , body             ,  'd'  , "body"             , "Specify HTTP body"                                               , ""              )
+        (std::string , token            ,  'T'  , "token"            , "Specify access token"                                            , ""              )
+        (bool        , is_json          ,  'j'  , "is-json"          , "Set data type to be json"                                                          )
+        (bool        , is_text          ,  'x'  , "is-text"          , "Set data type to be plain text"                                                    )
+        (bool        , is_form          ,  'f'  , "is-form"          , "Set data type to be form-urlencoded"                                               )
     ,
     (Result<void>)
 ) {
@@ -59,10 +89,10 @@ OPTS_MAIN(
 
     Opts::verbose = verbose;
 
-    if (test) {
-        const char* argv[] = {"test", "--order", "lex", ""};
+    if (test or bench) {
+        const char* argv[] = {"test", "--order", "lex", bench ? "[benchmark]" : ""};
         const auto argc = sizeof(argv) / sizeof(size_t);
-        if (verbose) argv[argc - 1] = "--success";
+        if (verbose and not bench) argv[argc - 1] = "--success";
 
         Catch::Session session;
         int res = session.run(argc, argv);
@@ -74,15 +104,69 @@ OPTS_MAIN(
         return Ok();
     }
 
-    users_create_table();
-    todos_create_table();
+    auto profile = [enabled = startup_profile, last = process_start](const char* phase) mutable {
+        if (not enabled) return;
+        auto now = std::chrono::steady_clock::now();
+        fmt::println("startup: {:<8} {:>8}us", phase, std::chrono::duration_cast<std::chrono::microseconds>(now - last).count());
+        last = now;
+    };
+
+    // route registration, option parsing and everything else before `main`
+    profile("static");
+
+    db_set_shards(shards);
+
+    if (migrate) {
+        db_migrate(false);
+        return Ok();
+    }
+
+    if (rebalance > 0) {
+        // both layouts need every table, including the archive
+        db_set_shards(rebalance);
+        db_migrate(false);
+        db_set_shards(shards);
+        db_migrate(false);
+        todos_rebalance(rebalance, shards);
+        return Ok();
+    }
+
+    if (memory) {
+        TRY(db_set_memory(snapshot));
+    }
+    profile("config");
+
+    // long running migrations continue in the background while serving
+    db_migrate(true);
+    profile("migrate");
+
+    rate_limit_setup(rate_limits);
+    if (not rate_limits.empty() and not epoll and route.empty()) {
+        delameta::warning(FL, "Client IPs are only known with --epoll, so every client of a route shares its IP rate limit");
+    }
+
+    if (archive_age > 0) {
+        todos_archive_start(std::chrono::hours(24 * archive_age), std::chrono::seconds(archive_interval));
+    }
 
     app.logger = [](const std::string& ip, const http::RequestReader& req, const http::ResponseWriter& res) {
         fmt::println("{:%Y-%m-%d %H:%M:%S} {} {} {} {}", now(), ip, req.method, req.url.full_path, res.status);
     };
 
+    profile("setup");
+    if (startup_profile) {
+        auto total = std::chrono::steady_clock::now() - process_start;
+        fmt::println("startup: {:<8} {:>8}us", "total", std::chrono::duration_cast<std::chrono::microseconds>(total).count());
+    }
+
     if (route.empty()) {
         fmt::println("Server is running on {}", uri.host);
+        if (epoll) {
+            compress_setup(compress_min, compress_level, compress_routes);
+            deadline_setup(deadlines);
+            shed_setup(shed_latency);
+            return server_listen(app, uri.host, workers, max_conn);
+        }
         return app.listen(http::Http::ListenArgs{
             .host=uri.host,
             .max_socket=max_sock
@@ -0,0 +1,363 @@
+#include <boost/preprocessor.hpp>
+#include <fmt/format.h>
+#include <delameta/debug.h>
+#include <sqlpp11/sqlpp11.h>
+#include <sqlpp11/sqlite3/connection.h>
+#include <sqlpp11/ppgen.h>
+#include <catch2/catch_test_macros.hpp>
+#include <thread>
+#include <set>
+#include <atomic>
+#include <algorithm>
+
+using namespace Project;
+using sql_db = sqlpp::sqlite3::connection;
+
+extern auto db_open(const char*) -> sql_db;
+extern auto db_get_shards() -> int;
+extern auto db_shard_path(int shard, int shards) -> std::string;
+extern void users_create_table(sql_db& db);
+extern void todos_create_table(sql_db& db);
+extern void todos_create_summary(sql_db& db);
+extern void todos_create_archive(sql_db& db);
+extern void todos_create_summary_archive(sql_db& db);
+
+SQLPP_DECLARE_TABLE(
+    (Migrations)
+    ,
+    (version   , int        , SQLPP_PRIMARY_KEY)
+    (name      , varchar(64), SQLPP_NOT_NULL   )
+    (applied_at, timestamp  , SQLPP_NOT_NULL   )
+)
+
+static const Migrations::Migrations migrations_table;
+
+// Which database files a migration applies to
+enum MigrationScope {
+    MIGRATION_USERS = 1 << 0,
+    MIGRATION_TODOS = 1 << 1,
+};
+
+// With `background`, online migrations are applied after the others, so offline migrations
+// must not depend on an online one applied before them.
+struct Migration {
+    int version;
+    const char* name;
+    int scope;
+    // Returns true when done. Online migrations are called repeatedly, one transaction per call,
+    // so each call should only process a small batch and keep its progress in `cursor`.
+    std::function<bool(sql_db&, int64_t& cursor)> step;
+    bool online = false;
+};
+
+// First column of the first row, 0 if there is none
+[[export]]
+auto db_query_int(sql_db& db, const char* query) -> int64_t {
+    sqlite3_stmt* stmt = nullptr;
+    int64_t res = 0;
+    if (sqlite3_prepare_v2(db.native_handle(), query, -1, &stmt, nullptr) == SQLITE_OK and sqlite3_step(stmt) == SQLITE_ROW) {
+        res = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return res;
+}
+
+// Append only, versions must be increasing
+static const std::vector<Migration> migrations = {
+    {1, "create users", MIGRATION_USERS, [](sql_db& db, int64_t&) {
+        users_create_table(db);
+        return true;
+    }},
+    {2, "create todos", MIGRATION_TODOS, [](sql_db& db, int64_t&) {
+        todos_create_table(db);
+        return true;
+    }},
+    // SQLite cannot build an index in batches, so the build runs in the background in one transaction:
+    // readers go on until the commit, and writers wait for it up to their busy timeout
+    {3, "index todos by user and date", MIGRATION_TODOS, [](sql_db& db, int64_t&) {
+        db.execute("CREATE INDEX IF NOT EXISTS Todos_user_id_created_at ON Todos(user_id, created_at)");
+        return true;
+    }, true},
+    {4, "summarize todos per user", MIGRATION_TODOS, [](sql_db& db, int64_t& cursor) {
+        const int64_t BATCH_USERS = 100;
+        if (cursor == 0) {
+            todos_create_summary(db);
+        }
+
+        // the archive may be created by a later migration while this one runs in the background
+        const bool has_archive = db_query_int(db, "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'TodosArchive'") > 0;
+        const char* all_todos = has_archive
+            ? "(SELECT user_id, is_done, created_at FROM Todos UNION ALL SELECT user_id, is_done, created_at FROM TodosArchive)"
+            : "Todos";
+
+        // triggers keep already backfilled users up to date, a batch recomputes its users from scratch
+        db.execute(fmt::format(R"(INSERT OR REPLACE INTO TodoSummaries (user_id, total, done, oldest_open)
+            SELECT user_id, COUNT(*), SUM(is_done), MIN(CASE WHEN is_done = 0 THEN created_at END)
+            FROM {} WHERE user_id > {} AND user_id <= {} GROUP BY user_id
+        )", all_todos, cursor, cursor + BATCH_USERS));
+
+        cursor += BATCH_USERS;
+        return cursor >= db_query_int(db, fmt::format("SELECT MAX(user_id) FROM {}", all_todos).c_str());
+    }, true},
+    {5, "archive completed todos", MIGRATION_TODOS, [](sql_db& db, int64_t&) {
+        todos_create_archive(db);
+        return true;
+    }},
+    {6, "never reuse todo ids", MIGRATION_TODOS, [](sql_db& db, int64_t&) {
+        if (db_query_int(db, "SELECT COUNT(*) FROM sqlite_master WHERE name = 'Todos' AND sql LIKE '%AUTOINCREMENT%'") > 0) {
+            return true;
+        }
+
+        // rebuild Todos with AUTOINCREMENT, its indexes and triggers go away with the old table
+        db.execute("ALTER TABLE Todos RENAME TO Todos_old");
+        todos_create_table(db);
+        db.execute("INSERT INTO Todos SELECT * FROM Todos_old WHERE id NOT IN (SELECT id FROM TodosArchive)");
+
+        // new ids start after every archived id, live todos that already share an id with an archived one are renumbered
+        db.execute("DELETE FROM sqlite_sequence WHERE name = 'Todos'");
+        db.execute(R"(INSERT INTO sqlite_sequence (name, seq) SELECT 'Todos', MAX(
+            IFNULL((SELECT MAX(id) FROM Todos), 0), IFNULL((SELECT MAX(id) FROM TodosArchive), 0)
+        ))");
+        db.execute(R"(INSERT INTO Todos (user_id, task, is_done, created_at)
+            SELECT user_id, task, is_done, created_at FROM Todos_old WHERE id IN (SELECT id FROM TodosArchive) ORDER BY id
+        )");
+        db.execute("DROP TABLE Todos_old");
+
+        // recreated after the copy, so the summary triggers do not count the todos twice
+        db.execute("CREATE INDEX IF NOT EXISTS Todos_user_id_created_at ON Todos(user_id, created_at)");
+        todos_create_summary(db);
+        return true;
+    }},
+    // summaries counted live todos only, so they dropped after every archive run
+    {7, "count archived todos in summaries", MIGRATION_TODOS, [](sql_db& db, int64_t&) {
+        todos_create_summary_archive(db);
+        db.execute(R"(UPDATE TodoSummaries SET
+            total = (SELECT COUNT(*) FROM Todos WHERE user_id = TodoSummaries.user_id)
+                  + (SELECT COUNT(*) FROM TodosArchive WHERE user_id = TodoSummaries.user_id),
+            done  = (SELECT COUNT(*) FROM Todos WHERE user_id = TodoSummaries.user_id AND is_done = 1)
+                  + (SELECT COUNT(*) FROM TodosArchive WHERE user_id = TodoSummaries.user_id AND is_done = 1)
+        )");
+        return true;
+    }},
+};
+
+// Pause between two batches of an online migration, so that request threads can take the write lock
+const auto MIGRATION_BATCH_INTERVAL = std::chrono::milliseconds(10);
+
+static auto db_user_version(sql_db& db) -> int {
+    return db_query_int(db, "PRAGMA user_version");
+}
+
+// `user_version` is set along with the migration when it is not 0
+static void migration_apply(sql_db& db, const Migration& migration, int user_version) {
+    delameta::info(FL, fmt::format("Applying migration {} `{}`", migration.version, migration.name));
+
+    int64_t cursor = 0;
+    db.execute("BEGIN");
+    while (not migration.step(db, cursor)) {
+        db.execute("COMMIT");
+        std::this_thread::sleep_for(MIGRATION_BATCH_INTERVAL);
+        db.execute("BEGIN");
+    }
+
+    db(insert_into(migrations_table).set(
+        migrations_table.version    = migration.version,
+        migrations_table.name       = migration.name,
+        migrations_table.applied_at = sqlpp::chrono::floor<std::chrono::seconds>(std::chrono::system_clock::now())
+    ));
+
+    // `user_version` holds the latest version once everything is applied, so startup can skip the file cheaply
+    if (user_version != 0) {
+        db.execute(fmt::format("PRAGMA user_version = {}", user_version));
+    }
+    db.execute("COMMIT");
+}
+
+// Applies pending migrations to one database file. With `background`, the online migrations are applied
+// by a background thread once the others are done, and the function returns early.
+static void migrate_file(const std::string& path, int scope, bool background, const std::vector<Migration>& all) {
+    std::vector<const Migration*> pending;
+    int latest = 0;
+    for (const auto& migration : all) {
+        if (migration.scope & scope) latest = migration.version;
+    }
+
+    auto db = db_open(path.c_str());
+    auto version = db_user_version(db);
+    if (version >= latest) return;
+
+    // lets the archive job give pages back with `incremental_vacuum`, only takes effect on new files
+    if (version == 0) {
+        db.execute("PRAGMA auto_vacuum = INCREMENTAL");
+    }
+
+    db.execute(R"(CREATE TABLE IF NOT EXISTS Migrations (
+        version    INTEGER        PRIMARY KEY,
+        name       VARCHAR(64)    NOT NULL,
+        applied_at TIMESTAMP      DEFAULT CURRENT_TIMESTAMP
+    ))");
+
+    std::set<int> applied;
+    for (const auto& row : db(select(migrations_table.version).from(migrations_table).unconditionally())) {
+        applied.insert(row.version.value());
+    }
+
+    for (const auto& migration : all) {
+        if ((migration.scope & scope) and not applied.contains(migration.version)) {
+            pending.push_back(&migration);
+        }
+    }
+
+    std::vector<const Migration*> foreground;
+    std::vector<const Migration*> online;
+    for (auto migration : pending) {
+        (background and migration->online ? online : foreground).push_back(migration);
+    }
+
+    for (auto migration : foreground) {
+        migration_apply(db, *migration, online.empty() and migration == foreground.back() ? latest : 0);
+    }
+    if (online.empty()) return;
+
+    std::thread([path, online, latest]() {
+        auto db = db_open(path.c_str());
+        // dirty pages stay in memory, so a long transaction only locks readers out for its commit
+        db.execute("PRAGMA cache_spill = OFF");
+        try {
+            for (auto migration : online) {
+                migration_apply(db, *migration, migration == online.back() ? latest : 0);
+            }
+        } catch (const std::exception& e) {
+            // the failure may have happened outside a transaction
+            if (not sqlite3_get_autocommit(db.native_handle())) db.execute("ROLLBACK");
+            delameta::warning(FL, fmt::format("Migration of {} failed: {}", path, e.what()));
+        }
+    }).detach();
+}
+
+[[export]]
+void db_migrate_file(const std::string& path, int scope, bool background) {
+    migrate_file(path, scope, background, migrations);
+}
+
+// Brings a todos file, e.g. a benchmark database, to the latest schema
+[[export]]
+void db_migrate_todos(const std::string& path) {
+    migrate_file(path, MIGRATION_TODOS, false, migrations);
+}
+
+[[export]]
+auto db_migration_applied(sql_db& db, int version) -> bool {
+    return db_user_version(db) >= version or
+        db_query_int(db, fmt::format("SELECT COUNT(*) FROM Migrations WHERE version = {}", version).c_str()) > 0;
+}
+
+[[export]]
+void db_migrate(bool background) {
+    const int shards = db_get_shards();
+    if (shards == 1) {
+        db_migrate_file(db_shard_path(0, 1), MIGRATION_USERS | MIGRATION_TODOS, background);
+        return;
+    }
+
+    db_migrate_file(db_shard_path(0, 1), MIGRATION_USERS, background);
+    for (int shard = 0; shard < shards; ++shard) {
+        db_migrate_file(db_shard_path(shard, shards), MIGRATION_TODOS, background);
+    }
+}
+
+TEST_CASE("7. migrate", "[migrate]") {
+    db_migrate_file("test.db", MIGRATION_USERS | MIGRATION_TODOS, false);
+
+    auto db = db_open("test.db");
+    REQUIRE(db_user_version(db) == migrations.back().version);
+
+    size_t count = 0;
+    for (const auto& row : db(select(migrations_table.version).from(migrations_table).unconditionally().order_by(migrations_table.version.asc()))) {
+        REQUIRE(row.version.value() == migrations[count++].version);
+    }
+    REQUIRE(count == migrations.size());
+
+    // applying again is a no-op
+    db_migrate_file("test.db", MIGRATION_USERS | MIGRATION_TODOS, false);
+    REQUIRE(db_user_version(db) == migrations.back().version);
+
+    // online migrations take several batches, in the foreground or in the background
+    for (bool background : {false, true}) {
+        std::atomic<int> batches = 0;
+        const std::vector<Migration> online_migrations = {
+            {1, "create", MIGRATION_TODOS, [](sql_db& db, int64_t&) {
+                db.execute("CREATE TABLE Batches (value INTEGER)");
+                return true;
+            }},
+            {2, "fill in batches", MIGRATION_TODOS, [&](sql_db& db, int64_t& cursor) {
+                ++batches;
+                db.execute(fmt::format("INSERT INTO Batches VALUES ({})", cursor));
+                return ++cursor == 3;
+            }, true},
+            {3, "after", MIGRATION_TODOS, [](sql_db& db, int64_t&) {
+                db.execute("CREATE TABLE After (value INTEGER)");
+                return true;
+            }},
+        };
+
+        migrate_file("migrate.db", MIGRATION_TODOS, background, online_migrations);
+
+        // offline migrations are applied before returning, even after an online one
+        auto db = db_open("migrate.db");
+        REQUIRE(db_migration_applied(db, 1));
+        REQUIRE(db_migration_applied(db, 3));
+        for (int i = 0; i < 500 and db_user_version(db) < 3; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        REQUIRE(db_user_version(db) == 3);
+        REQUIRE(batches == 3);
+        REQUIRE(db_query_int(db, "SELECT COUNT(*) FROM Batches") == 3);
+        ::remove("migrate.db");
+    }
+}
+
+TEST_CASE("7. migrate todo ids", "[migrate]") {
+    auto db = db_open("migrate.db");
+
+    // a Todos table from before migration 6, where the highest archived id was handed out again
+    db.execute(R"(CREATE TABLE Todos (
+        id         INTEGER        PRIMARY KEY,
+        user_id    INTEGER        REFERENCES Users(id) ON DELETE CASCADE,
+        task       VARCHAR(128)   NOT NULL,
+        is_done    BOOL           NOT NULL,
+        created_at TIMESTAMP      DEFAULT CURRENT_TIMESTAMP
+    ))");
+    todos_create_archive(db);
+    todos_create_summary(db);
+    db.execute("INSERT INTO Todos (id, user_id, task, is_done, created_at) VALUES (1, 1, 'live', 0, '2024-01-01 00:00:00')");
+    db.execute("INSERT INTO Todos (id, user_id, task, is_done, created_at) VALUES (3, 1, 'collides', 1, '2024-01-02 00:00:00')");
+    db.execute("INSERT INTO TodosArchive (id, user_id, task, is_done, created_at) VALUES (2, 1, 'archived', 1, '2023-01-01 00:00:00')");
+    db.execute("INSERT INTO TodosArchive (id, user_id, task, is_done, created_at) VALUES (3, 1, 'archived', 1, '2023-01-02 00:00:00')");
+
+    auto migration = std::find_if(migrations.begin(), migrations.end(), [](const Migration& m) { return m.version == 6; });
+    int64_t cursor = 0;
+    db.execute("BEGIN");
+    REQUIRE(migration->step(db, cursor));
+    db.execute("COMMIT");
+
+    // the live todo that shared an id with an archived one is renumbered after every archived id
+    REQUIRE(db_query_int(db, "SELECT COUNT(*) FROM Todos") == 2);
+    REQUIRE(db_query_int(db, "SELECT id FROM Todos WHERE task = 'live'") == 1);
+    REQUIRE(db_query_int(db, "SELECT id FROM Todos WHERE task = 'collides'") == 4);
+
+    // the summary is kept, and its triggers are back
+    REQUIRE(db_query_int(db, "SELECT total FROM TodoSummaries WHERE user_id = 1") == 2);
+    db.execute("INSERT INTO Todos (user_id, task, is_done, created_at) VALUES (1, 'new', 0, '2024-01-03 00:00:00')");
+    REQUIRE(db_query_int(db, "SELECT MAX(id) FROM Todos") == 5);
+    REQUIRE(db_query_int(db, "SELECT total FROM TodoSummaries WHERE user_id = 1") == 3);
+
+    // applying again is a no-op
+    db.execute("BEGIN");
+    REQUIRE(migration->step(db, cursor));
+    db.execute("COMMIT");
+    REQUIRE(db_query_int(db, "SELECT COUNT(*) FROM Todos") == 3);
+
+    ::remove("migrate.db");
+}
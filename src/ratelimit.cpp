@@ -0,0 +1,259 @@
+#include <fmt/format.h>
+#include <delameta/http/http.h>
+#include <catch2/catch_test_macros.hpp>
+#include <atomic>
+#include <shared_mutex>
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+using namespace Project;
+using etl::Ok;
+using etl::Err;
+namespace http = delameta::http;
+
+extern auto server_client_ip() -> const std::string&;
+
+struct RateLimit {
+    uint32_t rate;  // milli-tokens per second, so that slow rates such as 5 per minute are exact enough
+    uint32_t burst; // bucket capacity
+};
+
+// Lock-free token bucket: the last refill time (ms) and the remaining milli-tokens share one atomic word
+class TokenBucket {
+public:
+    TokenBucket(RateLimit limit, uint32_t now) : state(pack(now, limit.burst * 1000)) {}
+
+    auto take(RateLimit limit, uint32_t now) -> bool {
+        uint64_t expected = state.load(std::memory_order_relaxed);
+        for (;;) {
+            uint32_t last = expected >> 32;
+            uint64_t tokens = expected & 0xFFFFFFFF;
+
+            uint32_t elapsed = now - last;
+            tokens = std::min<uint64_t>(limit.burst * 1000ull, tokens + uint64_t(elapsed) * limit.rate / 1000);
+            if (tokens < 1000) return false;
+
+            if (state.compare_exchange_weak(expected, pack(now, tokens - 1000), std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    // Time of the last taken token (ms), the bucket only refills after it
+    auto last() const -> uint32_t {
+        return state.load(std::memory_order_relaxed) >> 32;
+    }
+
+private:
+    std::atomic<uint64_t> state;
+
+    static auto pack(uint32_t time, uint64_t tokens) -> uint64_t {
+        return (uint64_t(time) << 32) | tokens;
+    }
+};
+
+// Buckets are spread over shards so that concurrent requests rarely touch the same lock,
+// and the lock is only taken exclusively to insert a new key.
+const size_t RATE_LIMIT_SHARDS = 64;
+const size_t RATE_LIMIT_MAX_KEYS = 64 * 1024;
+// Share of a full shard forgotten at once
+const size_t RATE_LIMIT_EVICT = RATE_LIMIT_MAX_KEYS / RATE_LIMIT_SHARDS / 8;
+
+struct RateLimitShard {
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<TokenBucket>> buckets;
+};
+
+static std::unordered_map<std::string, RateLimit> rate_limits;
+static RateLimitShard rate_limit_shards[RATE_LIMIT_SHARDS];
+
+static auto now_ms() -> uint32_t {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Parses `<count>[/<unit>][/<burst>]`, the unit is `s` (default), `min` or `h` and the burst defaults to the count
+static auto rate_limit_parse(const std::string& limit) -> RateLimit {
+    std::vector<std::string> parts;
+    for (size_t pos = 0;;) {
+        auto slash = limit.find('/', pos);
+        parts.push_back(limit.substr(pos, slash - pos));
+        if (slash == std::string::npos) break;
+        pos = slash + 1;
+    }
+
+    uint32_t count = std::stoul(parts[0]);
+    uint32_t seconds = 1;
+    size_t next = 1;
+    if (parts.size() > 1 and not parts[1].empty() and not std::isdigit(static_cast<unsigned char>(parts[1][0]))) {
+        if (parts[1] == "s") seconds = 1;
+        else if (parts[1] == "min") seconds = 60;
+        else if (parts[1] == "h") seconds = 3600;
+        else throw std::invalid_argument(fmt::format("Unknown rate unit `{}` in `{}`", parts[1], limit));
+        next = 2;
+    }
+
+    uint32_t burst = parts.size() > next ? std::stoul(parts[next]) : count;
+    if (parts.size() > next + 1 or count == 0) {
+        throw std::invalid_argument(fmt::format("Invalid rate limit `{}`", limit));
+    }
+
+    return RateLimit{.rate=std::max<uint32_t>(uint64_t(count) * 1000 / seconds, 1), .burst=std::max(burst, 1u)};
+}
+
+// Limits are given as `{"<METHOD> <path>": "<count>[/<unit>][/<burst>]"}`, `*` applies to every other route
+[[export]]
+void rate_limit_setup(const std::unordered_map<std::string, std::string>& limits) {
+    for (const auto& [route, limit] : limits) {
+        rate_limits[route] = rate_limit_parse(limit);
+    }
+}
+
+static auto rate_limit_find(const http::RequestReader& req) -> const RateLimit* {
+    if (rate_limits.empty()) return nullptr;
+
+    auto it = rate_limits.find(fmt::format("{} {}", req.method, req.url.path));
+    if (it == rate_limits.end()) it = rate_limits.find("*");
+    return it == rate_limits.end() ? nullptr : &it->second;
+}
+
+// Forgets the buckets that took their last token the longest ago, they are the closest to full anyway
+static void rate_limit_evict(RateLimitShard& shard, uint32_t now) {
+    std::vector<std::pair<uint32_t, const std::string*>> idle;
+    idle.reserve(shard.buckets.size());
+    for (const auto& [key, bucket] : shard.buckets) {
+        idle.emplace_back(now - bucket->last(), &key);
+    }
+
+    auto count = std::min(RATE_LIMIT_EVICT, idle.size());
+    std::nth_element(idle.begin(), idle.begin() + count, idle.end(), std::greater<>());
+
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < count; ++i) keys.push_back(*idle[i].second);
+    for (const auto& key : keys) shard.buckets.erase(key);
+}
+
+static auto rate_limit_take(const std::string& key, RateLimit limit) -> bool {
+    auto& shard = rate_limit_shards[std::hash<std::string>{}(key) % RATE_LIMIT_SHARDS];
+    auto now = now_ms();
+
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.buckets.find(key);
+        if (it != shard.buckets.end()) return it->second->take(limit, now);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    if (shard.buckets.size() >= RATE_LIMIT_MAX_KEYS / RATE_LIMIT_SHARDS) {
+        rate_limit_evict(shard, now);
+    }
+
+    auto [it, _] = shard.buckets.try_emplace(key, std::make_unique<TokenBucket>(limit, now));
+    return it->second->take(limit, now);
+}
+
+static auto too_many_requests(http::ResponseWriter& res) -> http::Error {
+    res.headers["Retry-After"] = "1";
+    return http::Error{http::StatusTooManyRequests, "Too many requests"};
+}
+
+// Admits the request per client IP and returns the IP. Without a known IP, i.e. outside the epoll event loop,
+// all clients of the route share one bucket, so unauthenticated routes stay limited.
+[[export]]
+auto rate_limit_ip(const http::RequestReader& req, http::ResponseWriter& res) -> http::Result<std::string> {
+    const auto& ip = server_client_ip();
+    auto limit = rate_limit_find(req);
+    if (limit == nullptr) {
+        return Ok(ip);
+    }
+
+    if (not rate_limit_take(fmt::format("{} {} ip:{}", req.method, req.url.path, ip.empty() ? "*" : ip), *limit)) {
+        return Err(too_many_requests(res));
+    }
+    return Ok(ip);
+}
+
+// Admits the request per user and returns the user id
+[[export]]
+auto rate_limit_user(const http::RequestReader& req, http::ResponseWriter& res, uint64_t user_id) -> http::Result<uint64_t> {
+    auto limit = rate_limit_find(req);
+    if (limit == nullptr) {
+        return Ok(user_id);
+    }
+
+    if (not rate_limit_take(fmt::format("{} {} user:{}", req.method, req.url.path, user_id), *limit)) {
+        return Err(too_many_requests(res));
+    }
+    return Ok(user_id);
+}
+
+TEST_CASE("5. rate limit", "[rate limit]") {
+    rate_limit_setup({{"GET /limited", "1/2"}});
+
+    http::RequestReader req;
+    http::ResponseWriter res;
+    req.method = "GET";
+    req.url.path = "/limited";
+
+    REQUIRE(rate_limit_user(req, res, 42).unwrap() == 42);
+    REQUIRE(rate_limit_user(req, res, 42).unwrap() == 42);
+    REQUIRE(rate_limit_user(req, res, 42).unwrap_err().what == "Too many requests");
+
+    // buckets are per user
+    REQUIRE(rate_limit_user(req, res, 43).unwrap() == 43);
+
+    // other routes are not limited
+    req.url.path = "/unlimited";
+    REQUIRE(rate_limit_user(req, res, 42).unwrap() == 42);
+
+    // filling a shard with new keys does not refill a recently used bucket
+    req.url.path = "/limited";
+    auto shard_of = [](uint64_t user_id) {
+        return std::hash<std::string>{}(fmt::format("GET /limited user:{}", user_id)) % RATE_LIMIT_SHARDS;
+    };
+    auto& shard = rate_limit_shards[shard_of(42)];
+    for (size_t i = 0; shard.buckets.size() < RATE_LIMIT_MAX_KEYS / RATE_LIMIT_SHARDS; ++i) {
+        shard.buckets.try_emplace(fmt::format("old {}", i), std::make_unique<TokenBucket>(RateLimit{.rate=1, .burst=1}, now_ms() - 60'000));
+    }
+
+    uint64_t other = 44;
+    while (shard_of(other) != shard_of(42)) ++other;
+    REQUIRE(rate_limit_user(req, res, other).unwrap() == other);
+    REQUIRE(shard.buckets.contains("GET /limited user:42"));
+    REQUIRE(rate_limit_user(req, res, 42).unwrap_err().what == "Too many requests");
+
+    rate_limits.clear();
+    shard.buckets.clear();
+}
+
+TEST_CASE("5. rate limit units", "[rate limit]") {
+    REQUIRE(rate_limit_parse("5").rate == 5000);
+    REQUIRE(rate_limit_parse("5").burst == 5);
+    REQUIRE(rate_limit_parse("5/10").rate == 5000);
+    REQUIRE(rate_limit_parse("5/10").burst == 10);
+    REQUIRE(rate_limit_parse("5/min").rate == 83);
+    REQUIRE(rate_limit_parse("5/min").burst == 5);
+    REQUIRE(rate_limit_parse("1/h/3").rate == 1);
+    REQUIRE(rate_limit_parse("1/h/3").burst == 3);
+    REQUIRE_THROWS(rate_limit_parse("5/week"));
+    REQUIRE_THROWS(rate_limit_parse("0/10"));
+
+    // 5 per minute refills one token every 12 seconds
+    TokenBucket bucket(rate_limit_parse("5/min/1"), 0);
+    REQUIRE(bucket.take(rate_limit_parse("5/min/1"), 0));
+    REQUIRE(not bucket.take(rate_limit_parse("5/min/1"), 11'000));
+    REQUIRE(bucket.take(rate_limit_parse("5/min/1"), 12'100));
+
+    // without a client IP, the clients of a route share one bucket
+    rate_limit_setup({{"POST /login", "1/min"}});
+    http::RequestReader req;
+    http::ResponseWriter res;
+    req.method = "POST";
+    req.url.path = "/login";
+    REQUIRE(rate_limit_ip(req, res).is_ok());
+    REQUIRE(rate_limit_ip(req, res).is_err());
+
+    rate_limits.clear();
+    for (auto& shard : rate_limit_shards) shard.buckets.clear();
+}
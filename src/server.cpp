@@ -0,0 +1,641 @@
+#include <fmt/format.h>
+#include <delameta/http/http.h>
+#include <delameta/debug.h>
+#include <catch2/catch_test_macros.hpp>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+
+using namespace Project;
+using delameta::Result;
+using delameta::Error;
+using etl::Ok;
+using etl::Err;
+namespace http = delameta::http;
+
+HTTP_EXTERN_OBJECT(app);
+
+extern void compress_response(const http::RequestReader& req, http::ResponseWriter& res);
+extern void deadline_begin(const std::string& route, std::optional<std::string_view> timeout, std::chrono::steady_clock::time_point start);
+extern void deadline_end();
+extern auto shed_admit() -> bool;
+extern void shed_finish(std::chrono::steady_clock::time_point start);
+
+// Largest request head we are willing to buffer before giving up on a connection
+const size_t MAX_HEADER_SIZE = 16 * 1024;
+// Largest request body, larger requests are answered with 413 before they are read
+const size_t MAX_BODY_SIZE = 8 * 1024 * 1024;
+// Pending output above which a connection's pipelined requests wait for the client to read
+const size_t MAX_OUTPUT_SIZE = 1024 * 1024;
+// Connections without a completed request or sent response for this long are closed
+const auto IDLE_TIMEOUT = std::chrono::seconds(30);
+
+// `request_size` results that are not sizes
+const ssize_t REQUEST_INVALID = -1;
+const ssize_t REQUEST_TOO_LARGE = -2;
+
+static std::atomic<bool> server_running = false;
+
+// IP of the client whose request is being executed on this thread
+static thread_local std::string client_ip;
+
+[[export]]
+auto server_client_ip() -> const std::string& {
+    return client_ip;
+}
+
+struct Connection {
+    int fd;
+    std::string ip;
+    std::string in;
+    std::string out;
+    bool keep_alive = true;
+    std::chrono::steady_clock::time_point ready_at = {};
+    // admitted by the load shedder when it was queued
+    bool admitted = true;
+    // last completed request or sent response (steady ms), read by the idle sweep
+    std::atomic<int64_t> last_active = 0;
+};
+
+// Work-stealing pool: each worker pops from the front of its own queue and steals
+// from the back of the others when it runs dry.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t n, std::function<void(Connection*)> handler)
+        : queues(n), handler(std::move(handler)) {
+        for (size_t i = 0; i < n; ++i) {
+            threads.emplace_back([this, i]() { work(i); });
+        }
+    }
+
+    ~WorkerPool() {
+        stop();
+    }
+
+    // Waits for the running tasks, queued tasks are dropped
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        cv.notify_all();
+        for (auto& thread : threads) {
+            if (thread.joinable()) thread.join();
+        }
+    }
+
+    void push(Connection* conn) {
+        auto& queue = queues[next++ % queues.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(conn);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++pending;
+        }
+        cv.notify_one();
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Connection*> tasks;
+    };
+
+    std::vector<Queue> queues;
+    std::vector<std::thread> threads;
+    std::function<void(Connection*)> handler;
+    std::atomic<size_t> next = 0;
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t pending = 0;
+    bool stopped = false;
+
+    auto pop(size_t i) -> Connection* {
+        for (size_t k = 0; k < queues.size(); ++k) {
+            auto& queue = queues[(i + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) continue;
+
+            Connection* conn;
+            if (k == 0) {
+                conn = queue.tasks.front();
+                queue.tasks.pop_front();
+            } else {
+                conn = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            return conn;
+        }
+        return nullptr;
+    }
+
+    void work(size_t i) {
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this]() { return stopped or pending > 0; });
+                if (stopped) return;
+                --pending;
+            }
+
+            // `pending` counts pushed tasks, so a task is always available here
+            Connection* conn = nullptr;
+            while ((conn = pop(i)) == nullptr) std::this_thread::yield();
+            handler(conn);
+        }
+    }
+};
+
+static auto find_header(std::string_view head, std::string_view name) -> std::optional<std::string_view> {
+    size_t pos = head.find("\r\n");
+    while (pos != std::string_view::npos and pos + 2 < head.size()) {
+        auto line_start = pos + 2;
+        auto line_end = head.find("\r\n", line_start);
+        if (line_end == std::string_view::npos) break;
+
+        auto line = head.substr(line_start, line_end - line_start);
+        auto colon = line.find(':');
+        if (colon == name.size() and std::equal(name.begin(), name.end(), line.begin(), [](char a, char b) {
+            return std::tolower(a) == std::tolower(b);
+        })) {
+            auto value = line.substr(colon + 1);
+            while (not value.empty() and value.front() == ' ') value.remove_prefix(1);
+            return value;
+        }
+
+        pos = line_end;
+    }
+    return std::nullopt;
+}
+
+static auto iequals(std::string_view a, std::string_view b) -> bool {
+    return a.size() == b.size() and std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return std::tolower(x) == std::tolower(y);
+    });
+}
+
+// Size of the chunked body at the start of `buf`, 0 if more bytes are needed. Its decoded bytes are appended to `body`.
+// The encoded size is bounded by `MAX_BODY_SIZE`, and trailers are not supported.
+static auto chunked_size(std::string_view buf, std::string* body) -> ssize_t {
+    size_t pos = 0;
+    for (;;) {
+        auto line_end = buf.find("\r\n", pos);
+        if (line_end == std::string_view::npos) {
+            return buf.size() - pos > MAX_HEADER_SIZE ? REQUEST_INVALID : 0;
+        }
+
+        // at most 16 hex digits, so the size fits without wrapping
+        auto line = std::string(buf.substr(pos, line_end - pos));
+        char* end = nullptr;
+        size_t size = std::strtoull(line.c_str(), &end, 16);
+        if (line.empty() or not std::isxdigit(static_cast<unsigned char>(line[0])) or end - line.c_str() > 16) {
+            return REQUEST_INVALID;
+        }
+
+        pos = line_end + 2;
+        if (pos > MAX_BODY_SIZE or size > MAX_BODY_SIZE - pos) {
+            return REQUEST_TOO_LARGE;
+        }
+
+        if (size == 0) {
+            if (buf.size() < pos + 2) return 0;
+            return buf.substr(pos, 2) == "\r\n" ? static_cast<ssize_t>(pos + 2) : REQUEST_INVALID;
+        }
+
+        if (buf.size() < pos + size + 2) return 0;
+        if (body) body->append(buf.substr(pos, size));
+        pos += size + 2;
+    }
+}
+
+// Size of the first complete request in `buf`, 0 if more bytes are needed,
+// `REQUEST_INVALID` if the request is not supported and `REQUEST_TOO_LARGE` if its body is too large
+static auto request_size(std::string_view buf) -> ssize_t {
+    auto end = buf.find("\r\n\r\n");
+    if (end == std::string_view::npos) {
+        return buf.size() > MAX_HEADER_SIZE ? REQUEST_INVALID : 0;
+    }
+
+    auto head = buf.substr(0, end + 2);
+    if (auto encoding = find_header(head, "Transfer-Encoding")) {
+        if (not iequals(*encoding, "chunked")) {
+            return REQUEST_INVALID;
+        }
+        auto size = chunked_size(buf.substr(end + 4), nullptr);
+        return size > 0 ? static_cast<ssize_t>(end + 4 + size) : size;
+    }
+
+    size_t content_length = 0;
+    if (auto value = find_header(head, "Content-Length")) {
+        content_length = std::strtoull(std::string(*value).c_str(), nullptr, 10);
+    }
+    if (content_length > MAX_BODY_SIZE) {
+        return REQUEST_TOO_LARGE;
+    }
+
+    size_t total = end + 4 + content_length;
+    return buf.size() >= total ? static_cast<ssize_t>(total) : 0;
+}
+
+// Rewrites a complete chunked request into one with a `Content-Length`, as `http.execute` expects
+static auto request_dechunk(std::string_view request) -> std::string {
+    auto end = request.find("\r\n\r\n");
+    std::string body;
+    chunked_size(request.substr(end + 4), &body);
+
+    std::string res;
+    size_t pos = 0;
+    while (pos < end + 2) {
+        auto line_end = request.find("\r\n", pos);
+        auto line = request.substr(pos, line_end + 2 - pos);
+        auto colon = line.find(':');
+        auto name = line.substr(0, colon);
+        if (colon == std::string_view::npos or not (iequals(name, "Transfer-Encoding") or iequals(name, "Content-Length"))) {
+            res += line;
+        }
+        pos = line_end + 2;
+    }
+
+    res += fmt::format("Content-Length: {}\r\n\r\n", body.size());
+    res += body;
+    return res;
+}
+
+static auto request_keep_alive(std::string_view request) -> bool {
+    auto head = request.substr(0, request.find("\r\n\r\n") + 2);
+    auto connection = find_header(head, "Connection");
+    if (connection) {
+        return not iequals(*connection, "close");
+    }
+    // HTTP/1.0 closes by default
+    auto request_line = head.substr(0, head.find("\r\n"));
+    return not request_line.ends_with("HTTP/1.0");
+}
+
+// "<METHOD> <path>" of a request, without the query
+static auto request_route(std::string_view request) -> std::string {
+    auto request_line = request.substr(0, request.find("\r\n"));
+    auto method_end = request_line.find(' ');
+    auto path_end = request_line.find_first_of(" ?", method_end + 1);
+    return std::string(request_line.substr(0, path_end));
+}
+
+[[export]]
+auto server_execute(http::Http& http, const std::string& ip, std::string_view request, std::chrono::steady_clock::time_point start) -> std::string {
+    client_ip = ip;
+    auto head = request.substr(0, request.find("\r\n\r\n") + 2);
+    deadline_begin(request_route(request), find_header(head, "X-Request-Timeout"), start);
+
+    delameta::StringStream ss;
+    ss.write(request);
+
+    auto [req, res] = http.execute(ss);
+    compress_response(req, res);
+    if (http.logger) http.logger(ip, req, res);
+
+    std::string out;
+    res.dump() >> [&](std::string_view sv) {
+        out += sv;
+    };
+
+    deadline_end();
+    return out;
+}
+
+static auto steady_ms() -> int64_t {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Answers the complete requests in `conn->in`, in order, until the pending output reaches `MAX_OUTPUT_SIZE`
+static void server_answer(http::Http& http, Connection* conn) {
+    while (conn->keep_alive and conn->out.size() < MAX_OUTPUT_SIZE) {
+        auto size = request_size(conn->in);
+        if (size == REQUEST_TOO_LARGE) {
+            conn->out += "HTTP/1.1 413 Content Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            conn->keep_alive = false;
+            break;
+        }
+        if (size < 0) {
+            conn->out += "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+            conn->keep_alive = false;
+            break;
+        }
+        if (size == 0) break;
+
+        auto request = std::string_view(conn->in).substr(0, size);
+        conn->keep_alive = request_keep_alive(request);
+        if (conn->admitted and find_header(request.substr(0, request.find("\r\n\r\n") + 2), "Transfer-Encoding")) {
+            conn->out += server_execute(http, conn->ip, request_dechunk(request), conn->ready_at);
+        } else if (conn->admitted) {
+            conn->out += server_execute(http, conn->ip, request, conn->ready_at);
+        } else {
+            conn->out += "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: 1\r\n\r\n";
+        }
+        conn->in.erase(0, size);
+        conn->last_active = steady_ms();
+    }
+}
+
+// Returns false once the connection has to be closed
+static auto server_handle(http::Http& http, Connection* conn) -> bool {
+    // drain the socket, edge-triggered readiness is only reported once. Reading stops at the largest
+    // request we accept, or while the client does not read its responses, the one-shot rearm reports the rest.
+    char buf[16 * 1024];
+    bool open = true;
+    while (conn->in.size() <= MAX_HEADER_SIZE + MAX_BODY_SIZE and conn->out.size() < MAX_OUTPUT_SIZE) {
+        auto n = ::read(conn->fd, buf, sizeof(buf));
+        if (n > 0) {
+            conn->in.append(buf, n);
+        } else {
+            if (n == 0 or (errno != EAGAIN and errno != EWOULDBLOCK)) open = false;
+            break;
+        }
+    }
+
+    for (;;) {
+        server_answer(http, conn);
+
+        while (not conn->out.empty()) {
+            auto n = ::send(conn->fd, conn->out.data(), conn->out.size(), MSG_NOSIGNAL);
+            if (n > 0) {
+                conn->out.erase(0, n);
+                conn->last_active = steady_ms();
+            } else {
+                if (n < 0 and errno != EAGAIN and errno != EWOULDBLOCK) open = false;
+                break;
+            }
+        }
+
+        // requests held back by the output cap are answered once it drained
+        if (not open or not conn->out.empty() or not conn->keep_alive or request_size(conn->in) == 0) break;
+    }
+
+    return open and (conn->keep_alive or not conn->out.empty());
+}
+
+[[export]]
+void server_stop() {
+    server_running = false;
+}
+
+[[export]]
+auto server_listen(http::Http& http, const std::string& host, int workers, int max_connections) -> Result<void> {
+    auto colon = host.rfind(':');
+    auto hostname = host.substr(0, colon);
+    auto port = colon == std::string::npos ? std::string("80") : host.substr(colon + 1);
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    struct addrinfo* info = nullptr;
+    if (int res = ::getaddrinfo(hostname.c_str(), port.c_str(), &hints, &info); res != 0) {
+        return Err(Error{res, ::gai_strerror(res)});
+    }
+
+    int server_fd = ::socket(info->ai_family, info->ai_socktype | SOCK_NONBLOCK, info->ai_protocol);
+    int enable = 1;
+    ::setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    if (server_fd < 0 or ::bind(server_fd, info->ai_addr, info->ai_addrlen) < 0 or ::listen(server_fd, SOMAXCONN) < 0) {
+        auto err = Error{errno, ::strerror(errno)};
+        ::freeaddrinfo(info);
+        if (server_fd >= 0) ::close(server_fd);
+        return Err(std::move(err));
+    }
+    ::freeaddrinfo(info);
+
+    int epoll_fd = ::epoll_create1(0);
+    struct epoll_event listen_event = {};
+    listen_event.events = EPOLLIN | EPOLLET;
+    listen_event.data.ptr = nullptr;
+    ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &listen_event);
+
+    std::atomic<int> connections = 0;
+    std::mutex open_mutex;
+    std::unordered_set<Connection*> open;
+
+    // leaves `open` before the fd is closed, so the idle sweep never touches a closed or reused fd
+    auto close_connection = [&](Connection* conn) {
+        {
+            std::lock_guard<std::mutex> lock(open_mutex);
+            open.erase(conn);
+        }
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        ::close(conn->fd);
+        delete conn;
+        --connections;
+    };
+
+    if (workers <= 0) workers = std::max(1u, std::thread::hardware_concurrency());
+
+    WorkerPool pool(workers, [&](Connection* conn) {
+        const auto admitted = conn->admitted;
+        const auto ready_at = conn->ready_at;
+        const bool keep = server_handle(http, conn);
+
+        // queueing and execution count towards the shedder's latency
+        if (admitted) shed_finish(ready_at);
+        if (not keep) {
+            close_connection(conn);
+            return;
+        }
+
+        // one-shot rearm, so a connection is only ever handled by one worker at a time
+        struct epoll_event event = {};
+        event.events = EPOLLET | EPOLLONESHOT | EPOLLRDHUP |
+            (conn->out.size() < MAX_OUTPUT_SIZE ? EPOLLIN : 0) | (conn->out.empty() ? 0 : EPOLLOUT);
+        event.data.ptr = conn;
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+    });
+
+    server_running = true;
+    std::vector<struct epoll_event> events(1024);
+    int64_t last_sweep = steady_ms();
+
+    while (server_running) {
+        // idle connections, including ones trickling a request, are shut down. The worker that then
+        // reads the end of the stream closes them, so the sweep never races with a handler.
+        if (auto now = steady_ms(); now - last_sweep >= 1000) {
+            last_sweep = now;
+            auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(IDLE_TIMEOUT).count();
+            std::lock_guard<std::mutex> lock(open_mutex);
+            for (auto conn : open) {
+                if (now - conn->last_active > timeout) ::shutdown(conn->fd, SHUT_RDWR);
+            }
+        }
+
+        int n = ::epoll_wait(epoll_fd, events.data(), events.size(), 100);
+        for (int i = 0; i < n; ++i) {
+            auto conn = static_cast<Connection*>(events[i].data.ptr);
+            if (conn) {
+                // queueing time counts towards deadlines and the shedder's latency,
+                // and the shedder caps the connections queued or running in the pool
+                conn->ready_at = std::chrono::steady_clock::now();
+                conn->admitted = shed_admit();
+                pool.push(conn);
+                continue;
+            }
+
+            // accept everything pending on the edge-triggered listen socket
+            for (;;) {
+                struct sockaddr_storage addr = {};
+                socklen_t addr_len = sizeof(addr);
+                int fd = ::accept4(server_fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_len, SOCK_NONBLOCK);
+                if (fd < 0) break;
+
+                if (connections >= max_connections) {
+                    ::close(fd);
+                    continue;
+                }
+
+                int nodelay = 1;
+                ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+                char ip[INET6_ADDRSTRLEN] = {};
+                if (addr.ss_family == AF_INET) {
+                    ::inet_ntop(AF_INET, &reinterpret_cast<struct sockaddr_in*>(&addr)->sin_addr, ip, sizeof(ip));
+                } else {
+                    ::inet_ntop(AF_INET6, &reinterpret_cast<struct sockaddr_in6*>(&addr)->sin6_addr, ip, sizeof(ip));
+                }
+
+                ++connections;
+                auto conn = new Connection{.fd=fd, .ip=ip, .in={}, .out={}};
+                conn->last_active = steady_ms();
+                {
+                    std::lock_guard<std::mutex> lock(open_mutex);
+                    open.insert(conn);
+                }
+
+                struct epoll_event event = {};
+                event.events = EPOLLIN | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+                event.data.ptr = conn;
+                ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+            }
+        }
+    }
+
+    // no handler may touch the fds or a connection anymore once the pool is stopped
+    pool.stop();
+    for (auto conn : open) {
+        ::close(conn->fd);
+        delete conn;
+    }
+    ::close(server_fd);
+    ::close(epoll_fd);
+    return Ok();
+}
+
+TEST_CASE("10. server", "[server]") {
+    const std::string head = "POST /todos/import HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    const std::string request = head + "4\r\n{\"ta\r\n6\r\nsk\": 1\r\n0\r\n\r\n";
+
+    // incomplete until the last chunk
+    REQUIRE(request_size(request.substr(0, request.size() - 2)) == 0);
+    REQUIRE(request_size(request + "GET / HTTP/1.1\r\n") == static_cast<ssize_t>(request.size()));
+    REQUIRE(request_dechunk(request) == "POST /todos/import HTTP/1.1\r\nContent-Length: 10\r\n\r\n{\"task\": 1");
+
+    REQUIRE(request_size(head + "zz\r\n") == REQUEST_INVALID);
+    REQUIRE(request_size(head + "-1\r\n") == REQUEST_INVALID);
+    REQUIRE(request_size(head + "00000000000000001\r\n") == REQUEST_INVALID);
+
+    // a size that would wrap the position around
+    REQUIRE(request_size(head + "1\r\na\r\nffffffffffffffec\r\nxxxx") == REQUEST_TOO_LARGE);
+    REQUIRE(request_size(head + fmt::format("{:x}\r\n", MAX_BODY_SIZE)) == REQUEST_TOO_LARGE);
+    REQUIRE(request_size(fmt::format("POST / HTTP/1.1\r\nContent-Length: {}\r\n\r\n", MAX_BODY_SIZE + 1)) == REQUEST_TOO_LARGE);
+}
+
+// Run with `todo --bench`
+TEST_CASE("server benchmark", "[.][benchmark]") {
+    const int CONNECTIONS = 64;
+    const int REQUESTS = 1000;
+    const std::string request = "GET /user/verify HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\n\r\n";
+
+    // Returns false if the server closed the connection
+    auto read_response = [](int fd) {
+        std::string buf;
+        char chunk[4096];
+        for (;;) {
+            auto size = request_size(buf);
+            if (size > 0) {
+                auto connection = find_header(std::string_view(buf).substr(0, buf.find("\r\n\r\n") + 2), "Connection");
+                return not (connection and iequals(*connection, "close"));
+            }
+
+            auto n = ::read(fd, chunk, sizeof(chunk));
+            if (n <= 0) return false;
+            buf.append(chunk, n);
+        }
+    };
+
+    auto connect_to = [](int port) {
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        for (;;) {
+            int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0) return fd;
+            ::close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    };
+
+    auto run = [&](const char* name, int port) {
+        ::close(connect_to(port));
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> clients;
+        for (int c = 0; c < CONNECTIONS; ++c) {
+            clients.emplace_back([&]() {
+                int fd = connect_to(port);
+                for (int r = 0; r < REQUESTS; ++r) {
+                    ::send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+                    if (not read_response(fd)) {
+                        ::close(fd);
+                        fd = connect_to(port);
+                    }
+                }
+                ::close(fd);
+            });
+        }
+        for (auto& client : clients) client.join();
+
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fmt::println("{}: {} connections x {} requests in {:.3f}s ({:.0f} req/s)",
+            name, CONNECTIONS, REQUESTS, elapsed, CONNECTIONS * REQUESTS / elapsed);
+    };
+
+    auto logger = std::move(app.logger);
+    app.logger = [](const std::string&, const http::RequestReader&, const http::ResponseWriter&) {};
+
+    // the listener cannot be stopped, it goes away with the process
+    std::thread([]() {
+        (void) app.listen(http::Http::ListenArgs{.host="127.0.0.1:5101", .max_socket=4});
+    }).detach();
+    run("listen", 5101);
+
+    std::thread server([]() {
+        (void) server_listen(app, "127.0.0.1:5102", 0, 10000);
+    });
+    run("epoll", 5102);
+    server_stop();
+    server.join();
+
+    app.logger = std::move(logger);
+}
@@ -1,20 +1,37 @@
 #include <boost/preprocessor.hpp>
+#include <fmt/format.h>
+#include <fmt/ranges.h>
 #include <delameta/http/http.h>
 #include <sqlpp11/sqlpp11.h>
 #include <sqlpp11/sqlite3/connection.h>
 #include <sqlpp11/ppgen.h>
 #include <catch2/catch_test_macros.hpp>
+#include <delameta/debug.h>
+#include <thread>
+#include <algorithm>
+#include <set>
+#include <map>
+#include <functional>
 #include "chrono.h"
 
 using namespace Project;
 using etl::Ok;
 using etl::Err;
+using etl::Ref;
 using time_point = std::chrono::system_clock::time_point;
 using sql_db = sqlpp::sqlite3::connection;
 namespace http = delameta::http;
 
 extern auto db_open(const char*) -> sql_db;
-extern auto db_dependency(const http::RequestReader&, http::ResponseWriter&) -> sql_db;
+extern auto db_get_shards() -> int;
+extern auto db_shard_path(int shard, int shards) -> std::string;
+extern auto db_shard_of(std::string_view username, int shards) -> int;
+extern auto db_migration_applied(sql_db& db, int version) -> bool;
+extern void db_migrate_todos(const std::string& path);
+extern auto db_query_int(sql_db& db, const char* query) -> int64_t;
+extern auto db_quote(const std::string& value) -> std::string;
+extern auto users_get_usernames(sql_db& db) -> std::unordered_map<uint64_t, std::string>;
+extern auto db_dependency(const http::RequestReader&, http::ResponseWriter&) -> http::Result<sql_db>;
 extern auto user_get_id(const http::RequestReader&, http::ResponseWriter&) -> http::Result<uint64_t>;
 
 SQLPP_DECLARE_TABLE(
@@ -29,11 +46,40 @@ SQLPP_DECLARE_TABLE(
 
 static const Todos::Todos todos;
 
+SQLPP_DECLARE_TABLE(
+    (TodoSummaries)
+    ,
+    (user_id    , int      , SQLPP_PRIMARY_KEY)
+    (total      , int      , SQLPP_NOT_NULL   )
+    (done       , int      , SQLPP_NOT_NULL   )
+    (oldest_open, timestamp, SQLPP_NULL       )
+)
+
+static const TodoSummaries::TodoSummaries todo_summaries;
+
+// Migration that introduced `TodoSummaries`
+const int TODO_SUMMARIES_VERSION = 4;
+
+SQLPP_DECLARE_TABLE(
+    (TodosArchive)
+    ,
+    (id        , int         , SQLPP_PRIMARY_KEY)
+    (user_id   , int         , SQLPP_NOT_NULL   )
+    (task      , varchar(128), SQLPP_NOT_NULL   )
+    (is_done   , bool        , SQLPP_NOT_NULL   )
+    (created_at, timestamp   , SQLPP_NOT_NULL   )
+)
+
+static const TodosArchive::TodosArchive todos_archive;
+
+// Migration that introduced `TodosArchive`
+const int TODOS_ARCHIVE_VERSION = 5;
+
 [[export]]
-void todos_create_table(const char* path) {
-    auto db = db_open(path);
+void todos_create_table(sql_db& db) {
+    // AUTOINCREMENT, so the ids of archived todos are never handed out again
     db.execute(R"(CREATE TABLE IF NOT EXISTS Todos (
-        id         INTEGER        PRIMARY KEY,
+        id         INTEGER        PRIMARY KEY AUTOINCREMENT,
         user_id    INTEGER        REFERENCES Users(id) ON DELETE CASCADE,
         task       VARCHAR(128)   NOT NULL,
         is_done    BOOL           NOT NULL,
@@ -41,6 +87,218 @@ void todos_create_table(const char* path) {
     ))");
 }
 
+// Completed todos are moved here by `todos_archive_start`, keeping Todos small for active users
+[[export]]
+void todos_create_archive(sql_db& db) {
+    db.execute(R"(CREATE TABLE IF NOT EXISTS TodosArchive (
+        id         INTEGER        PRIMARY KEY,
+        user_id    INTEGER        NOT NULL,
+        task       VARCHAR(128)   NOT NULL,
+        is_done    BOOL           NOT NULL,
+        created_at TIMESTAMP      NOT NULL
+    ))");
+    db.execute("CREATE INDEX IF NOT EXISTS TodosArchive_user_id_created_at ON TodosArchive(user_id, created_at)");
+}
+
+// Moves at most `slice` completed todos created before `cutoff` and after `last_id` into the archive,
+// returns how many were moved. `last_id` is advanced, so a run walks the table once instead of rescanning
+// the kept todos for every slice.
+[[export]]
+auto todos_archive_slice(sql_db& db, time_point cutoff, size_t slice, int64_t& last_id) -> size_t {
+    std::vector<int64_t> ids;
+
+    db.execute("BEGIN");
+    for (const auto& row : db(
+        select(all_of(todos))
+            .from(todos)
+            .where(todos.id > last_id and todos.is_done == true and todos.created_at < cutoff)
+            .order_by(todos.id.asc())
+            .limit(slice)
+    )) {
+        db(insert_into(todos_archive).set(
+            todos_archive.id         = row.id.value(),
+            todos_archive.user_id    = row.user_id.value(),
+            todos_archive.task       = row.task.value(),
+            todos_archive.is_done    = row.is_done.value(),
+            todos_archive.created_at = row.created_at.value()
+        ));
+        ids.push_back(row.id.value());
+    }
+
+    if (not ids.empty()) {
+        db(remove_from(todos).where(todos.id.in(sqlpp::value_list(ids))));
+        last_id = ids.back();
+    }
+    db.execute("COMMIT");
+
+    return ids.size();
+}
+
+// Background job that archives completed todos older than `age` in throttled slices,
+// then gives free pages back and refreshes the query planner statistics
+[[export]]
+void todos_archive_start(std::chrono::hours age, std::chrono::seconds interval) {
+    const size_t SLICE = 500;
+    const auto SLICE_INTERVAL = std::chrono::milliseconds(50);
+
+    std::thread([age, interval]() {
+        for (;;) {
+            const int shards = db_get_shards();
+            for (int shard = 0; shard < shards; ++shard) {
+                try {
+                    auto db = db_open(db_shard_path(shard, shards).c_str());
+                    auto cutoff = std::chrono::system_clock::now() - age;
+
+                    size_t total = 0;
+                    int64_t last_id = 0;
+                    for (size_t moved = SLICE; moved == SLICE; total += moved) {
+                        moved = todos_archive_slice(db, cutoff, SLICE, last_id);
+                        std::this_thread::sleep_for(SLICE_INTERVAL);
+                    }
+
+                    if (total > 0) {
+                        delameta::info(FL, fmt::format("Archived {} todos of shard {}", total, shard));
+                        // only effective on files created with `auto_vacuum = INCREMENTAL`
+                        db.execute("PRAGMA incremental_vacuum(1000)");
+                        db.execute("PRAGMA optimize");
+                    }
+                } catch (const std::exception& e) {
+                    delameta::warning(FL, fmt::format("Failed to archive todos of shard {}: {}", shard, e.what()));
+                }
+            }
+            std::this_thread::sleep_for(interval);
+        }
+    }).detach();
+}
+
+// Per-user counters kept up to date by triggers, so a summary never scans the todo list
+[[export]]
+void todos_create_summary(sql_db& db) {
+    db.execute(R"(CREATE TABLE IF NOT EXISTS TodoSummaries (
+        user_id     INTEGER        PRIMARY KEY,
+        total       INTEGER        NOT NULL,
+        done        INTEGER        NOT NULL,
+        oldest_open TIMESTAMP
+    ))");
+
+    // finds the oldest open todo of a user without scanning
+    db.execute("CREATE INDEX IF NOT EXISTS Todos_user_id_is_done_created_at ON Todos(user_id, is_done, created_at)");
+
+    db.execute(R"(CREATE TRIGGER IF NOT EXISTS Todos_summary_insert AFTER INSERT ON Todos BEGIN
+        INSERT OR IGNORE INTO TodoSummaries (user_id, total, done, oldest_open) VALUES (NEW.user_id, 0, 0, NULL);
+        UPDATE TodoSummaries SET
+            total       = total + 1,
+            done        = done + NEW.is_done,
+            oldest_open = CASE WHEN NEW.is_done OR oldest_open <= NEW.created_at THEN oldest_open ELSE NEW.created_at END
+        WHERE user_id = NEW.user_id;
+    END)");
+
+    // archived todos keep counting, so their move out of Todos is skipped, see `todos_create_summary_archive`
+    const bool has_archive = db_query_int(db, "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'TodosArchive'") > 0;
+    db.execute(fmt::format(R"(CREATE TRIGGER IF NOT EXISTS Todos_summary_delete AFTER DELETE ON Todos {} BEGIN
+        UPDATE TodoSummaries SET
+            total       = total - 1,
+            done        = done - OLD.is_done,
+            oldest_open = CASE WHEN OLD.is_done OR OLD.created_at > oldest_open THEN oldest_open
+                ELSE (SELECT MIN(created_at) FROM Todos WHERE user_id = OLD.user_id AND is_done = 0) END
+        WHERE user_id = OLD.user_id;
+    END)", has_archive ? "WHEN NOT EXISTS (SELECT 1 FROM TodosArchive WHERE id = OLD.id)" : ""));
+
+    db.execute(R"(CREATE TRIGGER IF NOT EXISTS Todos_summary_update AFTER UPDATE OF is_done ON Todos
+    WHEN OLD.is_done <> NEW.is_done BEGIN
+        UPDATE TodoSummaries SET
+            done        = done + NEW.is_done - OLD.is_done,
+            oldest_open = (SELECT MIN(created_at) FROM Todos WHERE user_id = NEW.user_id AND is_done = 0)
+        WHERE user_id = NEW.user_id;
+    END)");
+}
+
+// The summary covers archived todos too: moves into the archive leave the counters alone,
+// and deletes from the archive are counted. Archived todos are done, so `oldest_open` is not affected.
+[[export]]
+void todos_create_summary_archive(sql_db& db) {
+    db.execute("DROP TRIGGER IF EXISTS Todos_summary_delete");
+    todos_create_summary(db);
+
+    db.execute(R"(CREATE TRIGGER IF NOT EXISTS TodosArchive_summary_delete AFTER DELETE ON TodosArchive BEGIN
+        UPDATE TodoSummaries SET
+            total = total - 1,
+            done  = done - OLD.is_done
+        WHERE user_id = OLD.user_id;
+    END)");
+}
+
+// Offline tool: move every todo, live and archived, from the `from` shards layout into the `to` shards layout.
+// Each batch of users is moved by one transaction over both files, so an interrupted run can simply be run again.
+// Moved todos get a new id in their destination shard.
+static void todos_rebalance_files(
+    const std::unordered_map<uint64_t, std::string>& usernames,
+    int from,
+    int to,
+    const std::function<std::string(int shard, int shards)>& shard_path
+) {
+    const size_t BATCH_USERS = 100;
+
+    for (int shard = 0; shard < from; ++shard) {
+        auto src_path = shard_path(shard, from);
+        auto src = db_open(src_path.c_str());
+
+        std::set<int64_t> users;
+        for (const auto& row : src(select(todos.user_id).flags(sqlpp::distinct).from(todos).unconditionally())) {
+            users.insert(row.user_id.value());
+        }
+        for (const auto& row : src(select(todos_archive.user_id).flags(sqlpp::distinct).from(todos_archive).unconditionally())) {
+            users.insert(row.user_id.value());
+        }
+
+        std::map<std::string, std::vector<int64_t>> moves;
+        for (auto user_id : users) {
+            auto it = usernames.find(user_id);
+            if (it == usernames.end()) continue;
+
+            auto dst_path = shard_path(db_shard_of(it->second, to), to);
+            if (dst_path != src_path) moves[dst_path].push_back(user_id);
+        }
+
+        size_t moved = 0;
+        for (const auto& [dst_path, user_ids] : moves) {
+            src.execute(fmt::format("ATTACH DATABASE {} AS dst", db_quote(dst_path)));
+
+            for (size_t i = 0; i < user_ids.size(); i += BATCH_USERS) {
+                auto batch = std::vector<int64_t>(user_ids.begin() + i, user_ids.begin() + std::min(i + BATCH_USERS, user_ids.size()));
+                auto in_batch = fmt::format("user_id IN ({})", fmt::join(batch, ", "));
+
+                src.execute("BEGIN");
+
+                // archived todos take their new ids from the destination Todos sequence, by way of Todos itself
+                auto last_id = db_query_int(src, "SELECT IFNULL(MAX(seq), 0) FROM dst.sqlite_sequence WHERE name = 'Todos'");
+                src.execute(fmt::format(R"(INSERT INTO dst.Todos (user_id, task, is_done, created_at)
+                    SELECT user_id, task, is_done, created_at FROM main.TodosArchive WHERE {} ORDER BY id)", in_batch));
+                src.execute(fmt::format("INSERT INTO dst.TodosArchive SELECT * FROM dst.Todos WHERE id > {}", last_id));
+                src.execute(fmt::format("DELETE FROM dst.Todos WHERE id > {}", last_id));
+
+                src.execute(fmt::format(R"(INSERT INTO dst.Todos (user_id, task, is_done, created_at)
+                    SELECT user_id, task, is_done, created_at FROM main.Todos WHERE {} ORDER BY id)", in_batch));
+
+                src.execute(fmt::format("DELETE FROM main.TodosArchive WHERE {}", in_batch));
+                src.execute(fmt::format("DELETE FROM main.Todos WHERE {}", in_batch));
+                src.execute("COMMIT");
+            }
+
+            src.execute("DETACH DATABASE dst");
+            moved += user_ids.size();
+        }
+
+        fmt::println("Moved the todos of {} users out of {}", moved, src_path);
+    }
+}
+
+[[export]]
+void todos_rebalance(int from, int to) {
+    auto users_db = db_open(nullptr);
+    todos_rebalance_files(users_get_usernames(users_db), from, to, db_shard_path);
+}
+
 JSON_DECLARE(
     (Todo)
     ,
@@ -50,8 +308,31 @@ JSON_DECLARE(
     (time_point , created_at)
 )
 
+JSON_DECLARE(
+    (TodoSummary)
+    ,
+    (uint64_t                 , total      )
+    (uint64_t                 , done       )
+    (uint64_t                 , open       )
+    (std::optional<time_point>, oldest_open)
+)
+
 HTTP_EXTERN_OBJECT(app);
 
+// Longest task accepted by every write path, which also bounds what an import buffers for a single todo
+const size_t TODO_MAX_TASK_SIZE = 4096;
+
+// Returns why `task` cannot be stored, if it cannot
+static auto todo_task_error(std::string_view task) -> std::optional<std::string> {
+    if (task.empty()) {
+        return "Task cannot be empty";
+    }
+    if (task.size() > TODO_MAX_TASK_SIZE) {
+        return fmt::format("Task cannot be longer than {} bytes", TODO_MAX_TASK_SIZE);
+    }
+    return std::nullopt;
+}
+
 HTTP_ROUTE(
     ("/todo", ("POST")),
     (todo_create),
@@ -62,8 +343,8 @@ HTTP_ROUTE(
     ,
     (http::Result<uint64_t>)
 ) {
-    if (task == "") {
-        return Err(http::Error{http::StatusBadRequest, "Task cannot be empty"});
+    if (auto err = todo_task_error(task)) {
+        return Err(http::Error{http::StatusBadRequest, std::move(*err)});
     }
 
     db(insert_into(todos).set(
@@ -91,6 +372,12 @@ HTTP_ROUTE(
     bool has_is_done = is_done.has_value();
     auto filter = todos.id == id && todos.user_id == user_id;
 
+    if (has_task) {
+        if (auto err = todo_task_error(*task)) {
+            return Err(http::Error{http::StatusBadRequest, std::move(*err)});
+        }
+    }
+
     if (has_task && has_is_done) {
         db(update(todos).set(todos.task = *task, todos.is_done = *is_done).where(filter));
     } else if (has_task) {
@@ -124,6 +411,7 @@ HTTP_ROUTE(
         (std::optional<time_point>, date_min, http::arg::default_val("date-min", std::nullopt))
         (std::optional<time_point>, date_max, http::arg::default_val("date-max", std::nullopt))
         (unsigned int             , limit   , http::arg::default_val("limit", 10)             )
+        (bool                     , archived, http::arg::default_val("archived", false)       )
     ,
     (std::list<Todo>)
 ) {
@@ -131,19 +419,28 @@ HTTP_ROUTE(
     if (not date_max) date_max.emplace(std::chrono::system_clock::now());
 
     std::list<Todo> res;
-    for (const auto& row : db(
-        select(todos.id, todos.task, todos.is_done, todos.created_at)
-            .from(todos)
-            .where(todos.user_id == user_id and todos.created_at >= *date_min and todos.created_at <= *date_max)
-            .order_by(todos.created_at.desc())
-            .limit(limit)
-    )) {
-        res.emplace_back(
-            row.id.value(),
-            row.task.value(),
-            row.is_done.value(),
-            row.created_at.value()
-        );
+    auto list = [&](const auto& table) {
+        for (const auto& row : db(
+            select(table.id, table.task, table.is_done, table.created_at)
+                .from(table)
+                .where(table.user_id == user_id and table.created_at >= *date_min and table.created_at <= *date_max)
+                .order_by(table.created_at.desc())
+                .limit(limit)
+        )) {
+            res.emplace_back(
+                row.id.value(),
+                row.task.value(),
+                row.is_done.value(),
+                row.created_at.value()
+            );
+        }
+    };
+
+    // nothing is archived before the archive migration
+    if (archived) {
+        if (db_migration_applied(db, TODOS_ARCHIVE_VERSION)) list(todos_archive);
+    } else {
+        list(todos);
     }
 
     return res;
@@ -157,15 +454,378 @@ HTTP_ROUTE(
     (void)
 ) {
     db(remove_from(todos).where(todos.user_id == user_id));
+    if (db_migration_applied(db, TODOS_ARCHIVE_VERSION)) {
+        db(remove_from(todos_archive).where(todos_archive.user_id == user_id));
+    }
+}
+
+HTTP_ROUTE(
+    ("/todos/summary", ("GET")),
+    (todos_summary),
+        (uint64_t, user_id, http::arg::depends(user_get_id)  )
+        (sql_db  , db     , http::arg::depends(db_dependency)),
+    (TodoSummary)
+) {
+    uint64_t total = 0;
+    uint64_t done = 0;
+    std::optional<time_point> oldest_open;
+
+    if (db_migration_applied(db, TODO_SUMMARIES_VERSION)) {
+        for (const auto& row : db(
+            select(todo_summaries.total, todo_summaries.done, todo_summaries.oldest_open)
+                .from(todo_summaries)
+                .where(todo_summaries.user_id == user_id)
+        )) {
+            total = row.total.value();
+            done = row.done.value();
+            if (not row.oldest_open.is_null()) oldest_open = row.oldest_open.value();
+        }
+    } else {
+        // the summaries are still being backfilled
+        auto count = [&](const auto& table) {
+            for (const auto& row : db(select(sqlpp::count(table.id).as(sqlpp::alias::a)).from(table).where(table.user_id == user_id))) {
+                total += row.a.value();
+            }
+            for (const auto& row : db(select(sqlpp::count(table.id).as(sqlpp::alias::a)).from(table).where(table.user_id == user_id and table.is_done == true))) {
+                done += row.a.value();
+            }
+        };
+
+        count(todos);
+        if (db_migration_applied(db, TODOS_ARCHIVE_VERSION)) count(todos_archive);
+        for (const auto& row : db(select(sqlpp::min(todos.created_at).as(sqlpp::alias::a)).from(todos).where(todos.user_id == user_id and todos.is_done == false))) {
+            if (not row.a.is_null()) oldest_open = row.a.value();
+        }
+    }
+
+    return TodoSummary{
+        .total       = total,
+        .done        = done,
+        .open        = total - done,
+        .oldest_open = oldest_open,
+    };
+}
+
+// Export and import formats, both carry the fields of `Todo`
+// - ndjson: one JSON `Todo` per line
+// - binary: per todo, a little endian u32 payload size, then u64 id, i64 created_at (unix seconds), u8 is_done and the task
+enum class TodoFormat { ndjson, binary };
+
+const size_t EXPORT_PAGE_SIZE = 1000;
+const size_t IMPORT_BATCH_SIZE = 10000;
+const size_t BINARY_HEADER_SIZE = 8 + 8 + 1;
+// Bounds what an import buffers for a single todo
+const size_t IMPORT_MAX_LINE_SIZE = 8 * TODO_MAX_TASK_SIZE;
+
+static auto todo_format(std::string_view format) -> std::optional<TodoFormat> {
+    if (format == "ndjson") return TodoFormat::ndjson;
+    if (format == "binary") return TodoFormat::binary;
+    return std::nullopt;
+}
+
+template <typename T>
+static void binary_put(std::string& out, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        out += static_cast<char>((static_cast<uint64_t>(value) >> (8 * i)) & 0xFF);
+    }
+}
+
+template <typename T>
+static auto binary_get(std::string_view in) -> T {
+    uint64_t value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value |= uint64_t(static_cast<uint8_t>(in[i])) << (8 * i);
+    }
+    return static_cast<T>(value);
+}
+
+static void todo_encode(const Todo& todo, TodoFormat format, std::string& out) {
+    if (format == TodoFormat::ndjson) {
+        out += delameta::json::serialize(todo);
+        out += '\n';
+        return;
+    }
+
+    binary_put<uint32_t>(out, BINARY_HEADER_SIZE + todo.task.size());
+    binary_put<uint64_t>(out, todo.id);
+    binary_put<int64_t>(out, std::chrono::system_clock::to_time_t(todo.created_at));
+    binary_put<uint8_t>(out, todo.is_done);
+    out += todo.task;
+}
+
+// Appends the page of a user's todos in `table` that follows `last_id`, returns how many were written.
+// Paging on the primary key keeps memory constant and does not hold a read transaction between pages.
+template <typename Table>
+static auto todos_export_page(sql_db& db, const Table& table, uint64_t user_id, int64_t& last_id, TodoFormat format, std::string& out) -> size_t {
+    size_t count = 0;
+    for (const auto& row : db(
+        select(table.id, table.task, table.is_done, table.created_at)
+            .from(table)
+            .where(table.user_id == user_id and table.id > last_id)
+            .order_by(table.id.asc())
+            .limit(EXPORT_PAGE_SIZE)
+    )) {
+        todo_encode(Todo{
+            .id         = static_cast<uint64_t>(row.id.value()),
+            .task       = row.task.value(),
+            .is_done    = row.is_done.value(),
+            .created_at = row.created_at.value(),
+        }, format, out);
+        last_id = row.id.value();
+        ++count;
+    }
+    return count;
+}
+
+static auto todos_prepare_insert(sql_db& db) {
+    return db.prepare(insert_into(todos).set(
+        todos.user_id    = parameter(todos.user_id),
+        todos.task       = parameter(todos.task),
+        todos.is_done    = parameter(todos.is_done),
+        todos.created_at = parameter(todos.created_at)
+    ));
+}
+
+// Parses a body fed in arbitrary chunks and inserts its todos in large transactions.
+// Imported todos get new ids.
+class TodoImporter {
+public:
+    size_t count = 0;
+
+    TodoImporter(sql_db& db, uint64_t user_id, TodoFormat format)
+        : db(db), user_id(user_id), format(format), insert(todos_prepare_insert(db)) {
+        db.execute("BEGIN");
+    }
+
+    // may run while unwinding, so it must not throw: the transaction may already be gone after a failed statement
+    ~TodoImporter() {
+        if (in_transaction and not sqlite3_get_autocommit(db.native_handle())) {
+            try {
+                db.execute("ROLLBACK");
+            } catch (const std::exception& e) {
+                delameta::warning(FL, fmt::format("Failed to roll back an import: {}", e.what()));
+            }
+        }
+    }
+
+    // Returns an error message, the current batch is rolled back
+    auto feed(std::string_view chunk) -> std::optional<std::string> {
+        pending += chunk;
+
+        size_t pos = 0;
+        auto err = format == TodoFormat::ndjson ? feed_ndjson(pos) : feed_binary(pos);
+        pending.erase(0, pos);
+
+        if (err) {
+            db.execute("ROLLBACK");
+            in_transaction = false;
+            return fmt::format("{} after {} imported todos", *err, count);
+        }
+        return std::nullopt;
+    }
+
+    auto finish() -> std::optional<std::string> {
+        if (format == TodoFormat::ndjson and not pending.empty()) {
+            if (auto err = feed("\n")) return err;
+        }
+        if (not pending.empty()) {
+            db.execute("ROLLBACK");
+            in_transaction = false;
+            return fmt::format("Truncated todo after {} imported todos", count);
+        }
+
+        db.execute("COMMIT");
+        in_transaction = false;
+        count += batch;
+        return std::nullopt;
+    }
+
+private:
+    sql_db& db;
+    uint64_t user_id;
+    TodoFormat format;
+    decltype(todos_prepare_insert(std::declval<sql_db&>())) insert;
+    std::string pending;
+    size_t batch = 0;
+    bool in_transaction = true;
+
+    auto add(std::string_view task, bool is_done, time_point created_at) -> std::optional<std::string> {
+        if (auto err = todo_task_error(task)) {
+            return err;
+        }
+
+        insert.params.user_id = user_id;
+        insert.params.task = task;
+        insert.params.is_done = is_done;
+        insert.params.created_at = std::chrono::time_point_cast<std::chrono::microseconds>(created_at);
+        db(insert);
+
+        if (++batch == IMPORT_BATCH_SIZE) {
+            db.execute("COMMIT");
+            db.execute("BEGIN");
+            count += batch;
+            batch = 0;
+        }
+        return std::nullopt;
+    }
+
+    auto feed_ndjson(size_t& pos) -> std::optional<std::string> {
+        for (size_t end; (end = pending.find('\n', pos)) != std::string::npos; pos = end + 1) {
+            auto line = std::string_view(pending).substr(pos, end - pos);
+            if (line.empty() or line == "\r") continue;
+
+            auto todo = delameta::json::deserialize<Todo>(std::string(line));
+            if (todo.is_err()) {
+                return fmt::format("Invalid todo: {}", todo.unwrap_err());
+            }
+
+            auto& item = todo.unwrap();
+            if (auto err = add(item.task, item.is_done, item.created_at)) return err;
+        }
+        if (pending.size() - pos > IMPORT_MAX_LINE_SIZE) {
+            return "Line is too long";
+        }
+        return std::nullopt;
+    }
+
+    auto feed_binary(size_t& pos) -> std::optional<std::string> {
+        while (pending.size() - pos >= 4) {
+            auto size = binary_get<uint32_t>(std::string_view(pending).substr(pos));
+            if (size < BINARY_HEADER_SIZE or size > BINARY_HEADER_SIZE + TODO_MAX_TASK_SIZE) {
+                return "Invalid todo size";
+            }
+            if (pending.size() - pos - 4 < size) break;
+
+            auto record = std::string_view(pending).substr(pos + 4, size);
+            auto created_at = std::chrono::system_clock::from_time_t(binary_get<int64_t>(record.substr(8)));
+            auto is_done = binary_get<uint8_t>(record.substr(16)) != 0;
+            if (auto err = add(record.substr(BINARY_HEADER_SIZE), is_done, created_at)) return err;
+
+            pos += 4 + size;
+        }
+        return std::nullopt;
+    }
+};
+
+HTTP_ROUTE(
+    ("/todos/export", ("GET")),
+    (todos_export),
+        (uint64_t                 , user_id, http::arg::depends(user_get_id)                      )
+        (sql_db                   , db     , http::arg::depends(db_dependency)                    )
+        (std::string              , format , http::arg::default_val("format", std::string("ndjson")))
+        (Ref<http::ResponseWriter>, res    , http::arg::response                                  ),
+    (http::Result<void>)
+) {
+    auto todo_fmt = todo_format(format);
+    if (not todo_fmt) {
+        return Err(http::Error{http::StatusBadRequest, "Format must be `ndjson` or `binary`"});
+    }
+
+    // live todos first, then the archived ones
+    struct Export {
+        sql_db db;
+        uint64_t user_id;
+        TodoFormat format;
+        bool archived;
+        int64_t last_id = 0;
+        bool done = false;
+        std::string page = {};
+    };
+
+    res->headers["Content-Type"] = *todo_fmt == TodoFormat::ndjson ? "application/x-ndjson" : "application/octet-stream";
+    res->headers["Transfer-Encoding"] = "chunked";
+
+    // one page per chunk, so only a single page is ever held in memory
+    const bool has_archive = db_migration_applied(db, TODOS_ARCHIVE_VERSION);
+    auto state = std::make_shared<Export>(Export{.db=std::move(db), .user_id=user_id, .format=*todo_fmt, .archived=false});
+    res->body_stream.rules.push_back([state, has_archive](delameta::Stream& stream) -> std::string_view {
+        std::string body;
+        if (not state->archived) {
+            if (todos_export_page(state->db, todos, state->user_id, state->last_id, state->format, body) < EXPORT_PAGE_SIZE) {
+                state->archived = true;
+                state->last_id = 0;
+                state->done = not has_archive;
+            }
+        } else {
+            state->done = todos_export_page(state->db, todos_archive, state->user_id, state->last_id, state->format, body) < EXPORT_PAGE_SIZE;
+        }
+
+        state->page.clear();
+        if (not body.empty()) {
+            state->page = fmt::format("{:x}\r\n{}\r\n", body.size(), body);
+        }
+        if (state->done) {
+            state->page += "0\r\n\r\n";
+        }
+
+        stream.again = not state->done;
+        return state->page;
+    });
+
+    return Ok();
+}
+
+HTTP_ROUTE(
+    ("/todos/import", ("POST")),
+    (todos_import),
+        (uint64_t                , user_id, http::arg::depends(user_get_id)                      )
+        (sql_db                  , db     , http::arg::depends(db_dependency)                    )
+        (std::string             , format , http::arg::default_val("format", std::string("ndjson")))
+        (Ref<http::RequestReader>, req    , http::arg::request                                   ),
+    (http::Result<uint64_t>)
+) {
+    auto todo_fmt = todo_format(format);
+    if (not todo_fmt) {
+        return Err(http::Error{http::StatusBadRequest, "Format must be `ndjson` or `binary`"});
+    }
+
+    TodoImporter importer(db, user_id, *todo_fmt);
+    std::optional<std::string> err;
+    auto feed = [&](std::string_view chunk) {
+        if (not err) err = importer.feed(chunk);
+    };
+
+    // the body is consumed as it arrives
+    feed(req->body);
+    req->body_stream >> feed;
+
+    if (not err) err = importer.finish();
+    if (err) {
+        return Err(http::Error{http::StatusBadRequest, std::move(*err)});
+    }
+    return Ok(importer.count);
 }
 
 TEST_CASE("2. todo", "[todo]") {
     SECTION("create table") {
-        todos_create_table("test.db");
+        auto db = db_open("test.db");
+        todos_create_table(db);
+        todos_create_summary(db);
+        todos_create_archive(db);
+        todos_create_summary_archive(db);
     }
 
     auto get_todo_list = []() {
-        return todos_get(1, db_open("test.db"), std::nullopt, std::nullopt, 10);
+        return todos_get(1, db_open("test.db"), std::nullopt, std::nullopt, 10, false);
+    };
+
+    // the counters kept by the triggers match the aggregates `todos_summary` falls back to
+    auto check_summary = [](uint64_t user_id) {
+        auto db = db_open("test.db");
+        auto expected = todos_summary(user_id, db_open("test.db"));
+
+        uint64_t total = 0;
+        uint64_t done = 0;
+        std::optional<time_point> oldest_open;
+        for (const auto& row : db(select(all_of(todo_summaries)).from(todo_summaries).where(todo_summaries.user_id == user_id))) {
+            total = row.total.value();
+            done = row.done.value();
+            if (not row.oldest_open.is_null()) oldest_open = row.oldest_open.value();
+        }
+
+        REQUIRE(total == expected.total);
+        REQUIRE(done == expected.done);
+        REQUIRE(oldest_open == expected.oldest_open);
     };
 
     auto todo_compare = [](const Todo& self, const Todo& other) {
@@ -186,6 +846,11 @@ TEST_CASE("2. todo", "[todo]") {
 
         todo_compare(todo_list.front(), Todo{.id=1, .task="new task", .is_done=false, .created_at={}});
         todo_compare(todo_list.back(), Todo{.id=2, .task="second task", .is_done=false, .created_at={}});
+        check_summary(1);
+
+        // every write path shares the task limit of imports
+        REQUIRE(todo_create(1, db_open("test.db"), std::string(TODO_MAX_TASK_SIZE + 1, 'a'), false).is_err());
+        REQUIRE(todo_put(1, db_open("test.db"), 1, std::string(TODO_MAX_TASK_SIZE + 1, 'a'), std::nullopt).is_err());
     }
 
     SECTION("update") {
@@ -197,6 +862,7 @@ TEST_CASE("2. todo", "[todo]") {
 
         todo_compare(todo_list.front(), Todo{.id=1, .task="first task", .is_done=false, .created_at={}});
         todo_compare(todo_list.back(), Todo{.id=2, .task="second task", .is_done=true, .created_at={}});
+        check_summary(1);
     }
 
     SECTION("delete") {
@@ -206,5 +872,204 @@ TEST_CASE("2. todo", "[todo]") {
         REQUIRE(todo_list.size() == 1);
 
         todo_compare(todo_list.front(), Todo{.id=2, .task="second task", .is_done=true, .created_at={}});
+        check_summary(1);
+    }
+
+    SECTION("summary") {
+        auto summary = todos_summary(1, db_open("test.db"));
+        REQUIRE(summary.total == 1);
+        REQUIRE(summary.done == 1);
+        REQUIRE(summary.open == 0);
+        REQUIRE(not summary.oldest_open);
+
+        todo_create(3, db_open("test.db"), "open task", false).unwrap();
+        todo_create(3, db_open("test.db"), "done task", true).unwrap();
+        check_summary(3);
+        REQUIRE(todos_summary(3, db_open("test.db")).oldest_open);
+
+        todos_delete(3, db_open("test.db"));
+        check_summary(3);
+        REQUIRE(todos_summary(3, db_open("test.db")).total == 0);
+    }
+
+    SECTION("archive") {
+        auto db = db_open("test.db");
+        todos_create_archive(db);
+
+        // the archive is only read once its migration is recorded
+        REQUIRE(todos_get(1, db_open("test.db"), std::nullopt, std::nullopt, 10, true).empty());
+        db.execute("CREATE TABLE IF NOT EXISTS Migrations (version INTEGER PRIMARY KEY, name VARCHAR(64) NOT NULL, applied_at TIMESTAMP NOT NULL)");
+        db.execute(fmt::format("INSERT OR IGNORE INTO Migrations VALUES ({}, 'archive', CURRENT_TIMESTAMP)", TODOS_ARCHIVE_VERSION));
+
+        auto cutoff = std::chrono::system_clock::now() + std::chrono::hours(1);
+        int64_t last_id = 0;
+        REQUIRE(todos_archive_slice(db, cutoff, 10, last_id) == 1);
+        REQUIRE(last_id == 2);
+        REQUIRE(todos_archive_slice(db, cutoff, 10, last_id) == 0);
+
+        REQUIRE(get_todo_list().empty());
+
+        auto archived_list = todos_get(1, db_open("test.db"), std::nullopt, std::nullopt, 10, true);
+        REQUIRE(archived_list.size() == 1);
+        todo_compare(archived_list.front(), Todo{.id=2, .task="second task", .is_done=true, .created_at={}});
+
+        // the id of the archived todo is not reused, nor the ids 3 and 4 deleted in "summary"
+        auto third_id = todo_create(1, db_open("test.db"), "third task", true).unwrap();
+        REQUIRE(third_id == 5);
+        REQUIRE(todos_archive_slice(db, cutoff, 10, last_id) == 1);
+
+        archived_list = todos_get(1, db_open("test.db"), std::nullopt, std::nullopt, 10, true);
+        REQUIRE(archived_list.size() == 2);
+        todo_compare(archived_list.back(), Todo{.id=5, .task="third task", .is_done=true, .created_at={}});
+
+        // archived todos still count in the summary
+        check_summary(1);
+        REQUIRE(todos_summary(1, db_open("test.db")).total == 2);
+    }
+
+    SECTION("export import") {
+        auto db = db_open("test.db");
+        for (auto format : {TodoFormat::ndjson, TodoFormat::binary}) {
+            std::string out;
+            todo_encode(Todo{.id=1, .task="imported task", .is_done=true, .created_at={}}, format, out);
+
+            TodoImporter importer(db, 2, format);
+            // split mid record
+            REQUIRE(not importer.feed(std::string_view(out).substr(0, 5)));
+            REQUIRE(not importer.feed(std::string_view(out).substr(5)));
+            REQUIRE(not importer.finish());
+            REQUIRE(importer.count == 1);
+        }
+
+        std::string page;
+        int64_t last_id = 0;
+        REQUIRE(todos_export_page(db, todos, 2, last_id, TodoFormat::ndjson, page) == 2);
+        REQUIRE(todos_export_page(db, todos, 2, last_id, TodoFormat::ndjson, page) == 0);
+        REQUIRE(std::count(page.begin(), page.end(), '\n') == 2);
+
+        // archived todos of user 1 are exported too
+        last_id = 0;
+        REQUIRE(todos_export_page(db, todos_archive, 1, last_id, TodoFormat::ndjson, page) == 2);
+
+        {
+            TodoImporter importer(db, 2, TodoFormat::ndjson);
+            REQUIRE(importer.feed("{\"task\": \"\"}\n"));
+        }
+        {
+            // a record or a line can not grow without bound
+            TodoImporter importer(db, 2, TodoFormat::binary);
+            REQUIRE(importer.feed(std::string(4, '\xFF')));
+        }
+        {
+            TodoImporter importer(db, 2, TodoFormat::ndjson);
+            REQUIRE(importer.feed(std::string(IMPORT_MAX_LINE_SIZE + 1, ' ')));
+        }
+    }
+}
+
+TEST_CASE("2. todo rebalance", "[todo]") {
+    auto shard_path = [](int shard, int shards) {
+        return fmt::format("rebalance.{}-{}.db", shard, shards);
+    };
+    auto count = [](const std::string& path, const std::string& query) {
+        auto db = db_open(path.c_str());
+        return db_query_int(db, query.c_str());
+    };
+
+    std::unordered_map<uint64_t, std::string> usernames;
+    for (uint64_t user_id = 1; user_id <= 6; ++user_id) {
+        usernames[user_id] = fmt::format("user {}", user_id);
+    }
+
+    for (auto [shard, shards] : {std::pair{0, 1}, std::pair{0, 2}, std::pair{1, 2}}) {
+        db_migrate_todos(shard_path(shard, shards));
+    }
+
+    // per user, an open and a done live todo, and an archived one
+    {
+        auto db = db_open(shard_path(0, 1).c_str());
+        for (const auto& [user_id, _] : usernames) {
+            db.execute(fmt::format("INSERT INTO Todos (user_id, task, is_done) VALUES ({0}, 'open', 0), ({0}, 'done', 1)", user_id));
+            db.execute(fmt::format("INSERT INTO Todos (user_id, task, is_done, created_at) VALUES ({}, 'old', 1, '2000-01-01 00:00:00')", user_id));
+        }
+        int64_t last_id = 0;
+        REQUIRE(todos_archive_slice(db, time_point{} + std::chrono::hours(24 * 365 * 31), 100, last_id) == usernames.size());
+    }
+
+    auto check = [&]() {
+        REQUIRE(count(shard_path(0, 1), "SELECT COUNT(*) FROM Todos") == 0);
+        REQUIRE(count(shard_path(0, 1), "SELECT COUNT(*) FROM TodosArchive") == 0);
+        REQUIRE(count(shard_path(0, 1), "SELECT IFNULL(SUM(total), 0) FROM TodoSummaries") == 0);
+
+        for (const auto& [user_id, username] : usernames) {
+            auto path = shard_path(db_shard_of(username, 2), 2);
+            auto other = shard_path(1 - db_shard_of(username, 2), 2);
+            REQUIRE(count(path, fmt::format("SELECT COUNT(*) FROM Todos WHERE user_id = {}", user_id)) == 2);
+            REQUIRE(count(path, fmt::format("SELECT COUNT(*) FROM TodosArchive WHERE user_id = {}", user_id)) == 1);
+            REQUIRE(count(path, fmt::format("SELECT total FROM TodoSummaries WHERE user_id = {}", user_id)) == 3);
+            REQUIRE(count(path, fmt::format("SELECT done FROM TodoSummaries WHERE user_id = {}", user_id)) == 2);
+            REQUIRE(count(other, fmt::format("SELECT COUNT(*) FROM Todos WHERE user_id = {}", user_id)) == 0);
+            REQUIRE(count(other, fmt::format("SELECT COUNT(*) FROM TodosArchive WHERE user_id = {}", user_id)) == 0);
+        }
+    };
+
+    todos_rebalance_files(usernames, 1, 2, shard_path);
+    check();
+
+    // running it again moves nothing
+    todos_rebalance_files(usernames, 1, 2, shard_path);
+    check();
+
+    for (auto [shard, shards] : {std::pair{0, 1}, std::pair{0, 2}, std::pair{1, 2}}) {
+        ::remove(shard_path(shard, shards).c_str());
+    }
+}
+
+TEST_CASE("todo export import benchmark", "[.][benchmark]") {
+    const size_t TODOS = 1'000'000;
+    const size_t CHUNK_SIZE = 64 * 1024;
+    const uint64_t USER_ID = 1;
+
+    // with the indexes and triggers of a migrated database
+    db_migrate_todos("bench.db");
+    auto db = db_open("bench.db");
+
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed_ms = [&]() {
+        auto now = std::chrono::steady_clock::now();
+        auto res = std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+        start = now;
+        return res;
+    };
+
+    std::string chunk;
+    size_t generated_bytes = 0;
+    TodoImporter importer(db, USER_ID, TodoFormat::ndjson);
+    for (size_t i = 0; i < TODOS; ++i) {
+        todo_encode(Todo{.id=i, .task=fmt::format("task {}", i), .is_done=i % 3 == 0, .created_at=std::chrono::system_clock::now()}, TodoFormat::ndjson, chunk);
+        if (chunk.size() >= CHUNK_SIZE or i + 1 == TODOS) {
+            generated_bytes += chunk.size();
+            REQUIRE(not importer.feed(chunk));
+            chunk.clear();
+        }
     }
+    REQUIRE(not importer.finish());
+    REQUIRE(importer.count == TODOS);
+    fmt::println("import: {} todos, {} bytes in {} ms", TODOS, generated_bytes, elapsed_ms());
+
+    for (auto format : {TodoFormat::ndjson, TodoFormat::binary}) {
+        std::string page;
+        int64_t last_id = 0;
+        size_t exported = 0, exported_bytes = 0, max_page = 0;
+        for (size_t n; (n = todos_export_page(db, todos, USER_ID, last_id, format, page)) > 0; page.clear()) {
+            exported += n;
+            exported_bytes += page.size();
+            max_page = std::max(max_page, page.size());
+        }
+        REQUIRE(exported == TODOS);
+        fmt::println("export {}: {} bytes in {} ms, largest page {} bytes",
+            format == TodoFormat::ndjson ? "ndjson" : "binary", exported_bytes, elapsed_ms(), max_page);
+    }
+
+    ::remove("bench.db");
 }
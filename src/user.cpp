@@ -14,11 +14,15 @@ using sql_db = sqlpp::sqlite3::connection;
 namespace http = delameta::http;
 
 extern auto db_open(const char*) -> sql_db;
-extern auto db_dependency(const http::RequestReader&, http::ResponseWriter&) -> sql_db;
+extern auto db_dependency(const http::RequestReader&, http::ResponseWriter&) -> http::Result<sql_db>;
+extern auto db_users_dependency(const http::RequestReader&, http::ResponseWriter&) -> http::Result<sql_db>;
 extern auto jwt_create_token(const std::vector<std::pair<std::string, std::string>>& payload) -> std::string;
 extern auto jwt_decode_token(const std::string& token) -> delameta::Result<std::string>;
 extern auto password_hash(const std::string& password) -> std::string;
 extern void todos_delete(uint64_t user_id, sql_db db);
+extern auto rate_limit_ip(const http::RequestReader& req, http::ResponseWriter& res) -> http::Result<std::string>;
+extern auto deadline_check() -> std::optional<http::Error>;
+extern auto rate_limit_user(const http::RequestReader& req, http::ResponseWriter& res, uint64_t user_id) -> http::Result<uint64_t>;
 
 SQLPP_DECLARE_TABLE(
     (Users)
@@ -32,8 +36,7 @@ SQLPP_DECLARE_TABLE(
 static const Users::Users users;
 
 [[export]]
-void users_create_table(const char* path) {
-    auto db = db_open(path);
+void users_create_table(sql_db& db) {
     db.execute(R"(CREATE TABLE IF NOT EXISTS Users (
         id         INTEGER        PRIMARY KEY,
         username   VARCHAR(32)    UNIQUE NOT NULL,
@@ -42,6 +45,15 @@ void users_create_table(const char* path) {
     ))");
 }
 
+[[export]]
+auto users_get_usernames(sql_db& db) -> std::unordered_map<uint64_t, std::string> {
+    std::unordered_map<uint64_t, std::string> res;
+    for (const auto& row : db(select(users.id, users.username).from(users).unconditionally())) {
+        res.emplace(row.id.value(), row.username.value());
+    }
+    return res;
+}
+
 JSON_DECLARE(
     (User)
     ,
@@ -73,8 +85,9 @@ HTTP_ROUTE(
 HTTP_ROUTE(
     ("/user/signup", ("POST")),
     (user_signup),
-        (sql_db  , db  , http::arg::depends(db_dependency))
-        (UserForm, user, http::arg::json                  ),
+        (std::string,     , http::arg::depends(rate_limit_ip)      )
+        (sql_db     , db  , http::arg::depends(db_users_dependency))
+        (UserForm   , user, http::arg::json                        ),
     (http::Result<std::string>)
 ) {
     if (user.username == "") {
@@ -83,6 +96,10 @@ HTTP_ROUTE(
         return Err(http::Error{http::StatusBadRequest, "Password cannot be empty"});
     }
 
+    if (auto err = deadline_check()) {
+        return Err(std::move(*err));
+    }
+
     try {
         db(insert_into(users).set(
             users.username   = user.username,
@@ -99,15 +116,23 @@ HTTP_ROUTE(
 HTTP_ROUTE(
     ("/user/login", ("POST")),
     (user_login),
-        (sql_db  , db  , http::arg::depends(db_dependency))
-        (UserForm, user, http::arg::json                  ),
+        (std::string,     , http::arg::depends(rate_limit_ip)      )
+        (sql_db     , db  , http::arg::depends(db_users_dependency))
+        (UserForm   , user, http::arg::json                        ),
     (http::Result<std::string>)
 ) {
     bool found = false;
     bool valid_password = false;
 
+    if (auto err = deadline_check()) {
+        return Err(std::move(*err));
+    }
+
     for (const auto& row : db(select(users.username, users.password).from(users).unconditionally())) {
         if ((found = row.username == user.username)) {
+            if (auto err = deadline_check()) {
+                return Err(std::move(*err));
+            }
             valid_password = row.password == password_hash(user.password);
             break;
         }
@@ -161,8 +186,13 @@ HTTP_ROUTE(
         (http::ResponseWriter&     , res, http::arg::response),
     (http::Result<uint64_t>)
 ) {
+    TRY(rate_limit_ip(req, res));
+    if (auto err = deadline_check()) {
+        return Err(std::move(*err));
+    }
+
     auto username = TRY(user_verify(req, res));
-    auto db = db_dependency(req, res);
+    auto db = TRY(db_users_dependency(req, res));
 
     auto row = db(select(users.id).from(users).where(users.username == username));
     if (row.begin() == row.end()) {
@@ -170,14 +200,14 @@ HTTP_ROUTE(
     }
 
     auto& item = *row.begin();
-    return Ok(item.id.value());
+    return rate_limit_user(req, res, item.id.value());
 }
 
 HTTP_ROUTE(
     ("/user", ("GET")),
     (user_get),
-        (sql_db     , db      , http::arg::depends(db_dependency))
-        (std::string, username, http::arg::depends(user_verify)  ),
+        (sql_db     , db      , http::arg::depends(db_users_dependency))
+        (std::string, username, http::arg::depends(user_verify)        ),
     (http::Result<User>)
 ) {
     auto row = db(select(users.username, users.created_at).from(users).where(users.username == username));
@@ -196,7 +226,7 @@ HTTP_ROUTE(
     ("/users", ("GET")),
     (users_get),
         (std::string              ,         , http::arg::depends(user_verify)                 )
-        (sql_db                   , db      , http::arg::depends(db_dependency)               )
+        (sql_db                   , db      , http::arg::depends(db_users_dependency)         )
         (std::optional<time_point>, date_min, http::arg::default_val("date-min", std::nullopt))
         (std::optional<time_point>, date_max, http::arg::default_val("date-max", std::nullopt))
         (unsigned int             , limit   , http::arg::default_val("limit", 10)             )
@@ -226,23 +256,26 @@ HTTP_ROUTE(
 HTTP_ROUTE(
     ("/user", ("DELETE")),
     (user_delete),
-        (uint64_t, user_id, http::arg::depends(user_get_id)  )
-        (sql_db  , db     , http::arg::depends(db_dependency)),
+        (uint64_t, user_id , http::arg::depends(user_get_id)        )
+        (sql_db  , db      , http::arg::depends(db_users_dependency))
+        (sql_db  , todos_db, http::arg::depends(db_dependency)      ),
     (void)
 ) {
+    // todos first, so a failure leaves the user able to retry
+    todos_delete(user_id, std::move(todos_db));
     db(remove_from(users).where(users.id == user_id));
-    todos_delete(user_id, std::move(db));
 }
 
 TEST_CASE("1. user", "[user]") {
     SECTION("create table") {
-        users_create_table("test.db");
+        auto db = db_open("test.db");
+        users_create_table(db);
     }
 
     static std::string token;
     SECTION("signup and login") {
-        auto token_signup = user_signup(db_open("test.db"), {.username="Prapto", .password="qwerty"}).unwrap();
-        auto token_login = user_login(db_open("test.db"), {.username="Prapto", .password="qwerty"}).unwrap();
+        auto token_signup = user_signup("", db_open("test.db"), {.username="Prapto", .password="qwerty"}).unwrap();
+        auto token_login = user_login("", db_open("test.db"), {.username="Prapto", .password="qwerty"}).unwrap();
         REQUIRE(token_signup == token_login);
         token = token_signup;
     }